@@ -0,0 +1,43 @@
+/*
+ * builtins.h - Definitions shared by the tiny shell and mkbuiltins.
+ *
+ * The builtins themselves are listed in builtins.def.  mkbuiltins picks a
+ * seed for builtin_hash() under which no two builtin names share a slot,
+ * and writes it and the slots to builtin_table.h.  Looking up a command is
+ * then one hash and one string compare, however many builtins there are.
+ */
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+// Flags of a builtin:
+#define BI_PARENT   0x1  // runs in the shell itself, not a child process
+#define BI_PIPELINE 0x2  // may be a stage of a pipeline
+#define BI_JOBLOCK  0x4  // runs with SIGCHLD blocked, as it uses the jobs
+
+struct Builtin {
+	const char *name;
+	int (*handler)(char **argv);  // returns the exit status
+	int flags;                    // BI_* flags
+	const char *usage;            // one-line synopsis, for help
+	const char *help;             // one-line description, for help
+};
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the FNV-1a hash of "name", perturbed by "seed".
+ */
+static inline unsigned int
+builtin_hash(const char *name, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ seed;
+
+	while (*name != '\0')
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return (h ^ (h >> 16));
+}
+
+#endif // BUILTINS_H
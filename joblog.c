@@ -0,0 +1,476 @@
+/*
+ * joblog.c - The writer thread behind the shell's per-job log files.
+ *
+ * The shell sends the writer each new job's pipe over a control pipe, so
+ * that handing one over costs a single write() and takes no lock.  The
+ * writer polls the control pipe and every job's pipe, opens and rotates
+ * the files, and moves the data with splice(), so that it goes from the
+ * pipe to the page cache without passing through user space.  Where the
+ * file system does not support splice(), it falls back to read() and
+ * write() of up to LOGCHUNK bytes.  Each pipe is enlarged to LOGPIPE bytes
+ * so that a busy job is drained in a few large moves.
+ */
+
+#define _GNU_SOURCE // for splice() and F_SETPIPE_SZ
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "joblog.h"
+
+#define MAXLOGS  64             // pipes the writer first makes room for
+#define LOGCHUNK (1 << 20)      // most bytes moved at a time
+#define LOGPIPE  (1 << 20)      // size asked for each job's pipe
+
+// A job's pipe and log file, as handed to the writer.
+struct LogMsg {
+	int fd;                 // read end of the job's pipe
+	int dir;                // directory of the log file
+	int jid;                // the job's ID and PID, for the file name
+	pid_t pid;
+	long long maxsize;      // size at which the file is rotated
+	int maxkeep;            // rotated files to keep
+};
+
+// A pipe being drained by the writer, which alone uses these.
+struct Log {
+	struct LogMsg msg;      // msg.fd is -1 if the slot is free
+	int file;               // the current log file, or -1
+	char name[48];          // its name in msg.dir
+	long long size;         // bytes in the current file
+	int rotated;            // number of rotated files kept so far
+	bool discard;           // the file failed, so the output is dropped
+};
+
+// The writer's pipes, and what it polls, with room for "maxlogs" pipes.
+static struct Log *logs = NULL;
+static struct pollfd *pfds = NULL;
+static struct Log **ready = NULL;
+static int maxlogs = 0;
+
+// The shell's side.  Directory descriptors are never closed, since the
+// writer may still be using one after the shell moves on to another.
+static int logdir = -1;                 // current log directory, or -1
+static char *logdirname = NULL;         // and its name
+static long long logsize = JOBLOG_SIZE;
+static int logkeep = JOBLOG_KEEP;
+static int ctl[2] = { -1, -1 };         // control pipe to the writer
+static pid_t owner = 0;                 // the process the writer is in
+static pthread_t writer;
+
+static bool	drain(struct Log *log);
+static struct Log *	freelog(void);
+static void	giveup(struct Log *log);
+static bool	openlog(struct Log *log);
+static void	*writer_main(void *arg);
+
+/*
+ * Requires:
+ *   "dir" is a properly terminated string, or NULL.
+ *
+ * Effects:
+ *   Logs the background jobs started from now on to files in "dir", or
+ *   stops logging new jobs if "dir" is NULL.  Returns false, leaving the
+ *   setting unchanged, if "dir" cannot be opened as a directory.
+ */
+bool
+joblog_setdir(const char *dir)
+{
+	int fd = -1;
+	char *name = NULL;
+
+	if (dir != NULL && ((fd = open(dir, O_PATH | O_DIRECTORY |
+	    O_CLOEXEC)) < 0 || (name = strdup(dir)) == NULL)) {
+		if (fd >= 0)
+			close(fd);
+		return (false);
+	}
+	logdir = fd;
+	free(logdirname);
+	logdirname = name;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "size" is positive.
+ *
+ * Effects:
+ *   Rotates the log files of the jobs started from now on once they reach
+ *   "size" bytes.
+ */
+void
+joblog_setsize(long long size)
+{
+
+	logsize = size;
+}
+
+/*
+ * Requires:
+ *   "keep" is not negative.
+ *
+ * Effects:
+ *   Keeps "keep" rotated files of each job started from now on, removing
+ *   the oldest one as another is rotated.
+ */
+void
+joblog_setkeep(int keep)
+{
+
+	logkeep = keep;
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the log directory, or NULL if jobs are not being logged.
+ */
+const char *
+joblog_dir(void)
+{
+
+	return (logdir >= 0 ? logdirname : NULL);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the size at which log files are rotated.
+ */
+long long
+joblog_size(void)
+{
+
+	return (logsize);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the number of rotated files kept of each job.
+ */
+int
+joblog_keep(void)
+{
+
+	return (logkeep);
+}
+
+/*
+ * Requires:
+ *   A log directory is set, and "fd" is the read end of the pipe that job
+ *   "jid", with PID "pid", writes its output to.
+ *
+ * Effects:
+ *   Hands "fd" to the writer thread, which closes it at end of file,
+ *   starting the thread first if this process has none.  Closes "fd" if
+ *   there is no writer.
+ */
+void
+joblog_add(int fd, int jid, pid_t pid)
+{
+	struct LogMsg msg = { .fd = fd, .dir = logdir, .jid = jid, .pid = pid,
+	    .maxsize = logsize, .maxkeep = logkeep };
+	sigset_t all, prev;
+	bool first = owner == 0;
+
+	if (owner != getpid()) {
+		/*
+		 * The writer runs with every signal blocked, so that the
+		 * shell's handlers only ever run in the main thread.
+		 */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &prev);
+		if (pipe2(ctl, O_CLOEXEC) < 0 ||
+		    pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+			pthread_sigmask(SIG_SETMASK, &prev, NULL);
+			perror("tsh: log writer");
+			close(fd);
+			return;
+		}
+		pthread_sigmask(SIG_SETMASK, &prev, NULL);
+		owner = getpid();
+		if (first)
+			atexit(joblog_finish);
+	}
+	// A message this small is written atomically.
+	if (write(ctl[1], &msg, sizeof(msg)) != sizeof(msg))
+		close(fd);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Called at exit, or before exec, in the process that runs the writer.
+ *   Closes the control pipe and waits until the writer has moved what the
+ *   pipes hold now into the files, so that finished jobs lose none of
+ *   their output.  A later joblog_add() starts a new writer.
+ */
+void
+joblog_finish(void)
+{
+
+	if (owner != getpid())
+		return;
+	close(ctl[1]);
+	pthread_join(writer, NULL);
+	close(ctl[0]);
+	ctl[0] = ctl[1] = -1;
+	owner = -1;
+}
+
+/*
+ * Requires:
+ *   This is called in a child process right after fork().
+ *
+ * Effects:
+ *   Forgets the parent's writer thread, which the child does not have, so
+ *   that the child starts its own if it logs a job.
+ */
+void
+joblog_forget(void)
+{
+
+	if (owner == 0)
+		return;
+	close(ctl[0]);
+	close(ctl[1]);
+	ctl[0] = ctl[1] = -1;
+	owner = -1;
+}
+
+/*
+ * Requires:
+ *   "log" has an open pipe, which is readable or at end of file.
+ *
+ * Effects:
+ *   Moves what the pipe holds, up to LOGCHUNK bytes, into the log file,
+ *   opening the file first or rotating it if it is full.  Once the file
+ *   cannot be opened or written, reads and drops what the pipe holds
+ *   instead, so that the job keeps running rather than dying of SIGPIPE.
+ *   At end of file, closes the pipe and the file and frees the slot.
+ *   Returns false once the pipe is empty.
+ */
+static bool
+drain(struct Log *log)
+{
+	static char buf[LOGCHUNK];
+	ssize_t n, done, w;
+	size_t len;
+
+	if (!log->discard && (log->file < 0 ||
+	    log->size >= log->msg.maxsize) && !openlog(log))
+		giveup(log);
+	if (log->discard)
+		n = read(log->msg.fd, buf, LOGCHUNK);
+	else {
+		len = log->msg.maxsize - log->size < LOGCHUNK ?
+		    (size_t)(log->msg.maxsize - log->size) : LOGCHUNK;
+		n = splice(log->msg.fd, NULL, log->file, NULL, len,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0 && errno == EINVAL &&
+		    (n = read(log->msg.fd, buf, len)) > 0) {
+			for (done = 0; done < n; done += w)
+				if ((w = write(log->file, &buf[done],
+				    n - done)) < 0) {
+					giveup(log);
+					break;
+				}
+		} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			// The file failed, and the data is still in the pipe.
+			giveup(log);
+			return (true);
+		}
+	}
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return (false);
+	if (n > 0) {
+		log->size += n;
+		return (true);
+	}
+	// The job and everything it started have closed the pipe.
+	close(log->msg.fd);
+	if (log->file >= 0)
+		close(log->file);
+	log->msg.fd = log->file = -1;
+	return (false);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns a free slot for a pipe, first doubling the room for pipes if
+ *   every slot is in use.  Returns NULL if there is no memory for more.
+ */
+static struct Log *
+freelog(void)
+{
+	struct Log *nlogs, **nready;
+	struct pollfd *npfds;
+	int i, n;
+
+	for (i = 0; i < maxlogs && logs[i].msg.fd >= 0; i++)
+		;
+	if (i < maxlogs)
+		return (&logs[i]);
+	n = maxlogs > 0 ? 2 * maxlogs : MAXLOGS;
+	if ((nlogs = realloc(logs, n * sizeof(*logs))) == NULL)
+		return (NULL);
+	logs = nlogs;
+	if ((npfds = realloc(pfds, (n + 1) * sizeof(*pfds))) == NULL)
+		return (NULL);
+	pfds = npfds;
+	if ((nready = realloc(ready, (n + 1) * sizeof(*ready))) == NULL)
+		return (NULL);
+	ready = nready;
+	for (i = maxlogs; i < n; i++)
+		logs[i].msg.fd = logs[i].file = -1;
+	i = maxlogs;
+	maxlogs = n;
+	return (&logs[i]);
+}
+
+/*
+ * Requires:
+ *   errno says why the log's file could not be opened or written.
+ *
+ * Effects:
+ *   Prints why, closes the file, and has drain() drop the rest of the
+ *   job's output.
+ */
+static void
+giveup(struct Log *log)
+{
+
+	fprintf(stderr, "tsh: %s: %s; dropping the job's output\n",
+	    log->name, strerror(errno));
+	if (log->file >= 0)
+		close(log->file);
+	log->file = -1;
+	log->discard = true;
+}
+
+
+/*
+ * Requires:
+ *   "log" has an open pipe.
+ *
+ * Effects:
+ *   Opens the log's file.  A full one is first renamed to ".1", after
+ *   the rotated ones are shifted up by one, which replaces the oldest
+ *   once "maxkeep" of them are kept.  Returns false, with errno set, if
+ *   that fails.
+ */
+static bool
+openlog(struct Log *log)
+{
+	char from[sizeof(log->name) + 16], to[sizeof(log->name) + 16];
+	int i;
+
+	if (log->file >= 0) {
+		close(log->file);
+		if (log->rotated < log->msg.maxkeep)
+			log->rotated++;
+		for (i = log->rotated; i > 1; i--) {
+			snprintf(from, sizeof(from), "%s.%d", log->name, i - 1);
+			snprintf(to, sizeof(to), "%s.%d", log->name, i);
+			renameat(log->msg.dir, from, log->msg.dir, to);
+		}
+		// With nothing kept, the full file is simply truncated.
+		if (log->msg.maxkeep > 0) {
+			snprintf(to, sizeof(to), "%s.1", log->name);
+			renameat(log->msg.dir, log->name, log->msg.dir, to);
+		}
+	} else
+		snprintf(log->name, sizeof(log->name), "job%d-%d.log",
+		    log->msg.jid, (int)log->msg.pid);
+	log->size = 0;
+	log->file = openat(log->msg.dir, log->name, O_WRONLY | O_CREAT |
+	    O_TRUNC | O_CLOEXEC, 0666);
+	return (log->file >= 0);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   The writer thread: drains every job's pipe into its log file as data
+ *   arrives, and takes new pipes from the control pipe.  Once the control
+ *   pipe is closed, drains what the pipes hold and returns.
+ */
+static void *
+writer_main(void *arg)
+{
+	struct pollfd ctlfd, *fds;
+	struct LogMsg msg;
+	struct Log *log;
+	int i, n;
+	bool done = false;
+
+	(void)arg;
+	for (i = 0; i < maxlogs; i++)
+		logs[i].msg.fd = logs[i].file = -1;
+	while (!done) {
+		// Until there is room for pipes, the control pipe is alone.
+		fds = pfds != NULL ? pfds : &ctlfd;
+		fds[0].fd = ctl[0];
+		fds[0].events = POLLIN;
+		for (n = 1, i = 0; i < maxlogs; i++) {
+			if (logs[i].msg.fd < 0)
+				continue;
+			pfds[n].fd = logs[i].msg.fd;
+			pfds[n].events = POLLIN;
+			ready[n++] = &logs[i];
+		}
+		if (poll(fds, n, -1) < 0)
+			continue;
+		for (i = 1; i < n; i++)
+			if (pfds[i].revents != 0)
+				while (drain(ready[i]))
+					;
+		if (fds[0].revents == 0)
+			continue;
+		if (read(ctl[0], &msg, sizeof(msg)) != sizeof(msg)) {
+			done = true;
+			break;
+		}
+		if ((log = freelog()) == NULL) {
+			fprintf(stderr, "tsh: too many jobs to log\n");
+			close(msg.fd);
+			continue;
+		}
+		fcntl(msg.fd, F_SETFL, O_NONBLOCK);
+		fcntl(msg.fd, F_SETPIPE_SZ, LOGPIPE);
+		log->msg = msg;
+		log->file = -1;
+		log->rotated = 0;
+		log->discard = false;
+	}
+	// Takes what the jobs have written so far, without waiting for more.
+	for (i = 0; i < maxlogs; i++)
+		while (logs[i].msg.fd >= 0 && drain(&logs[i]))
+			;
+	return (NULL);
+}
@@ -0,0 +1,32 @@
+/*
+ * joblog.h - Per-job log files for the tiny shell's background jobs.
+ *
+ * With a log directory set, the shell gives each background job a pipe as
+ * its stdout and stderr and hands the read end to joblog_add().  A single
+ * writer thread moves everything that arrives on those pipes into one file
+ * per job, "job<jid>-<pid>.log".  A file that reaches the size limit is
+ * renamed to "job<jid>-<pid>.log.1", after shifting the older ones to
+ * ".2", ".3", and so on and removing the one past the keep count, before
+ * a new one is started.  The shell itself never waits for the disk.
+ */
+
+#ifndef JOBLOG_H
+#define JOBLOG_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define JOBLOG_SIZE (16LL << 20)        // default size limit of a file
+#define JOBLOG_KEEP 5                   // default number of rotated files
+
+bool	joblog_setdir(const char *dir);
+void	joblog_setsize(long long size);
+void	joblog_setkeep(int keep);
+const char *joblog_dir(void);
+long long	joblog_size(void);
+int	joblog_keep(void);
+void	joblog_add(int fd, int jid, pid_t pid);
+void	joblog_forget(void);
+void	joblog_finish(void);
+
+#endif // JOBLOG_H
@@ -0,0 +1,70 @@
+/*
+ * mkbuiltins.c - Generate the tiny shell's builtin hash table.
+ *
+ * usage: mkbuiltins > builtin_table.h
+ *
+ * Finds a seed for which builtin_hash() puts every name in builtins.def in
+ * its own slot of a power-of-two table at least twice as large as the
+ * number of builtins, and prints the seed and the table as C.  Each slot
+ * holds the index of its builtin in builtins.def, or -1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+
+static const char *const names[] = {
+#define BUILTIN(name, handler, flags, usage, help)	#name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#define NBUILTINS ((int)(sizeof(names) / sizeof(names[0])))
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Prints builtin_table.h, or exits with status 1 if no seed works.
+ */
+int
+main(void)
+{
+	int slot[1024];
+	unsigned int mask, seed;
+	int i, s;
+
+	for (mask = 1; mask + 1 < 2 * NBUILTINS; mask = 2 * mask + 1)
+		;
+	for (; mask < sizeof(slot) / sizeof(slot[0]); mask = 2 * mask + 1) {
+		for (seed = 0; seed < 100000; seed++) {
+			for (s = 0; s <= (int)mask; s++)
+				slot[s] = -1;
+			for (i = 0; i < NBUILTINS; i++) {
+				s = builtin_hash(names[i], seed) & mask;
+				if (slot[s] >= 0)
+					break;
+				slot[s] = i;
+			}
+			if (i == NBUILTINS)
+				goto found;
+		}
+	}
+	fprintf(stderr, "mkbuiltins: no perfect hash found\n");
+	exit(1);
+
+found:
+	printf("/* Generated by mkbuiltins from builtins.def; do not edit. */\n");
+	printf("\n");
+	printf("#define BUILTIN_SEED %uu\n", seed);
+	printf("#define BUILTIN_MASK %uu\n", mask);
+	printf("\n");
+	printf("static const signed char builtin_slot[%u] = {", mask + 1);
+	for (s = 0; s <= (int)mask; s++)
+		printf("%s%d%s", s % 16 == 0 ? "\n\t" : " ", slot[s],
+		    s < (int)mask ? "," : "\n");
+	printf("};\n");
+	return (0);
+}
@@ -0,0 +1,242 @@
+/*
+ * myload.c - A configurable workload for load-testing your tiny shell
+ *
+ * usage: myload [-c secs] [-m MB] [-w MB [-r MB/s]] [-f n] [-d ms [-j ms]]
+ *               [-s seed] [-x code | -k sig]
+ *
+ * Forks n grandchildren, then every process (this one and each
+ * grandchild) allocates and touches MB megabytes, burns secs seconds of
+ * CPU, and writes MB megabytes of 'x' lines to stdout, at most MB/s if a
+ * rate is given.  The grandchildren then exit.  This process waits ms
+ * milliseconds, plus a random 0 to ms more with -j, reaps the grandchildren,
+ * and then exits with the given code or sends itself the given signal,
+ * named (INT, TSTP, ...) or numbered.  After a stop signal it exits with
+ * the code once continued.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const signames[] = {
+	[SIGHUP] = "HUP", [SIGINT] = "INT", [SIGQUIT] = "QUIT",
+	[SIGABRT] = "ABRT", [SIGKILL] = "KILL", [SIGUSR1] = "USR1",
+	[SIGSEGV] = "SEGV", [SIGUSR2] = "USR2", [SIGPIPE] = "PIPE",
+	[SIGALRM] = "ALRM", [SIGTERM] = "TERM", [SIGCONT] = "CONT",
+	[SIGSTOP] = "STOP", [SIGTSTP] = "TSTP", [SIGTTIN] = "TTIN",
+	[SIGTTOU] = "TTOU",
+};
+
+static double	now(void);
+static int	parsesig(const char *arg);
+static void	sleep_for(double secs);
+static void	usage(const char *prog);
+static void	work(double cpu, long mem, double out, double rate);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Runs the workload described on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	double cpu = 0, out = 0, rate = 0, delay = 0, jitter = 0;
+	long mem = 0, i, forks = 0;
+	unsigned int seed = getpid();
+	int c, code = 0, sig = 0;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "hc:m:w:r:f:d:j:s:x:k:")) != -1) {
+		switch (c) {
+		case 'c':
+			cpu = atof(optarg);
+			break;
+		case 'm':
+			mem = atol(optarg);
+			break;
+		case 'w':
+			out = atof(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'f':
+			forks = atol(optarg);
+			break;
+		case 'd':
+			delay = atof(optarg) / 1000;
+			break;
+		case 'j':
+			jitter = atof(optarg) / 1000;
+			break;
+		case 's':
+			seed = atol(optarg);
+			break;
+		case 'x':
+			code = atoi(optarg);
+			break;
+		case 'k':
+			if ((sig = parsesig(optarg)) <= 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+
+	for (i = 0; i < forks; i++) {
+		if ((pid = fork()) < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			work(cpu, mem, out, rate);
+			exit(0);
+		}
+	}
+	work(cpu, mem, out, rate);
+	srandom(seed);
+	sleep_for(delay + jitter * random() / RAND_MAX);
+	while (wait(NULL) > 0)
+		;
+
+	if (sig > 0 && kill(getpid(), sig) < 0)
+		perror("kill");
+	exit(code);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the current CLOCK_MONOTONIC time in seconds.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Requires:
+ *   "arg" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the number of the signal named (with or without "SIG") or
+ *   numbered by "arg", or -1 if there is no such signal.  Traces use
+ *   numbers, since sdriver.pl would take a line containing "INT" or
+ *   "TSTP" for a driver command.
+ */
+static int
+parsesig(const char *arg)
+{
+	size_t i;
+
+	if (arg[0] >= '0' && arg[0] <= '9')
+		return (atoi(arg) < NSIG ? atoi(arg) : -1);
+	if (strncmp(arg, "SIG", 3) == 0)
+		arg += 3;
+	for (i = 0; i < sizeof(signames) / sizeof(signames[0]); i++)
+		if (signames[i] != NULL && strcmp(signames[i], arg) == 0)
+			return (i);
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Sleeps for "secs" seconds, if positive, resuming after signals.
+ */
+static void
+sleep_for(double secs)
+{
+	struct timespec ts;
+
+	if (secs <= 0)
+		return;
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) < 0)
+		;
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Allocates and touches "mem" MB, spins for "cpu" seconds, and writes
+ *   "out" MB of 64-byte 'x' lines to stdout, no faster than "rate" MB/s if
+ *   "rate" is positive.
+ */
+static void
+work(double cpu, long mem, double out, double rate)
+{
+	static char chunk[65536];
+	volatile unsigned long spin = 0;
+	double start;
+	long total, done, n, page = sysconf(_SC_PAGESIZE);
+	char *p;
+
+	if (mem > 0) {
+		if ((p = malloc(mem << 20)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		for (n = 0; n < mem << 20; n += page)
+			p[n] = 1;
+	}
+	for (start = now(); now() - start < cpu; )
+		for (n = 0; n < 100000; n++)
+			spin++;
+	if (out > 0) {
+		memset(chunk, 'x', sizeof(chunk));
+		for (n = 63; n < (long)sizeof(chunk); n += 64)
+			chunk[n] = '\n';
+		total = (long)(out * (1 << 20));
+		for (start = now(), done = 0; done < total; done += n) {
+			n = total - done < (long)sizeof(chunk) ?
+			    total - done : (long)sizeof(chunk);
+			if (write(STDOUT_FILENO, chunk, n) != n) {
+				perror("write");
+				exit(1);
+			}
+			if (rate > 0)
+				sleep_for((done + n) / (rate * (1 << 20)) -
+				    (now() - start));
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "prog" is a properly terminated string.
+ *
+ * Effects:
+ *   Prints a help message and terminates the program.
+ */
+static void
+usage(const char *prog)
+{
+
+	fprintf(stderr, "Usage: %s [-c secs] [-m MB] [-w MB [-r MB/s]] "
+	    "[-f n] [-d ms [-j ms]] [-s seed] [-x code | -k sig]\n", prog);
+	exit(1);
+}
@@ -0,0 +1,583 @@
+/*
+ * parse.c - Command line tokenizer for the tiny shell.
+ *
+ * The tokenizer makes a single pass over the line.  Most of a command line
+ * is ordinary word characters, so it first looks for the next byte that is
+ * special (a blank, quote, backslash, "$", "#", or operator) and copies the
+ * ordinary bytes before it into the word in one go.  That search classifies
+ * 16 bytes at a time with SSE2 (or 32 with AVX2, if asked for) when the CPU
+ * has it, and otherwise uses a lookup table.
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOK_X86
+#endif
+
+#include "parse.h"
+
+/*
+ * The bytes that end a run of ordinary word characters.  '#' only starts a
+ * comment at the beginning of a word, but is rare enough to check for
+ * separately.
+ */
+static const unsigned char special[256] = {
+	['\0'] = 1, ['\t'] = 1, ['\n'] = 1, [' '] = 1, ['"'] = 1,
+	['#'] = 1, ['$'] = 1, ['&'] = 1, ['\''] = 1, [';'] = 1,
+	['\\'] = 1, ['|'] = 1,
+};
+
+static size_t	scan_scalar(const char *p, size_t n);
+#ifdef TOK_X86
+static size_t	scan_sse2(const char *p, size_t n);
+static size_t	scan_avx2(const char *p, size_t n);
+#endif
+
+// The scan function for the instruction set in use.
+static size_t	(*scan)(const char *p, size_t n) = NULL;
+
+static bool	beginword(struct Tokens *t, bool *inword, size_t at);
+static bool	endword(struct Tokens *t, bool *inword, size_t at);
+static bool	expandcmd(const char *line, size_t len, size_t *pos,
+		    struct Tokens *t, bool *inword, bool quoted);
+static bool	fail(struct Tokens *t, const char *error);
+static void	markdollar(struct Tokens *t);
+static size_t	matchparen(const char *line, size_t len, size_t i);
+
+/*
+ * Requires:
+ *   "line" holds "len" bytes, "*pos" is at most "len", and "t" has been set
+ *   up with its words, arena, and expand callback.
+ *
+ * Effects:
+ *   Tokenizes the command that starts at offset "*pos" of "line" into
+ *   t->words and advances "*pos" past the operator that ends it.  Outside
+ *   quotes, blanks separate words, a backslash quotes the next character,
+ *   and "#" at the start of a word begins a comment.  Single quotes keep
+ *   everything up to the next single quote.  Double quotes keep everything
+ *   up to the next unescaped double quote, except that "\" still escapes
+ *   '$', '`', '"', '\', and newline, and "$?" and "$(command)" are still
+ *   expanded.  The output of a command outside double quotes is split into
+ *   words at blanks and newlines.  Records where each other '$' outside
+ *   single quotes lands in the arena if t->dollars is set, so that the
+ *   caller can expand it.  Returns the TOK_* value of the operator that
+ *   ended the command, or TOK_ERROR after setting t->error.
+ */
+int
+tokenize(const char *line, size_t len, size_t *pos, struct Tokens *t)
+{
+	size_t i = *pos, run;
+	bool inword = false;
+	int term = TOK_END;
+	const char *close;
+
+	/*
+	 * Command words are short, so AVX2's wider blocks rarely pay for
+	 * themselves ("tshbench parse" measures SSE2 as faster), and SSE2 is
+	 * the default when the CPU has it.
+	 */
+	if (scan == NULL)
+		tok_set_isa(tok_isa() < TOK_ISA_SSE2 ? tok_isa() :
+		    TOK_ISA_SSE2);
+	t->nwords = 0;
+	t->used = 0;
+	t->ndollars = 0;
+	t->start = t->end = i;
+	t->error = NULL;
+	while (true) {
+		// Copies the run of ordinary characters in one go.
+		if ((run = scan(&line[i], len - i)) > 0) {
+			if (!beginword(t, &inword, i) ||
+			    !tok_append(t, &line[i], run))
+				return (TOK_ERROR);
+			i += run;
+		}
+		if (i >= len)
+			break;
+
+		switch (line[i]) {
+		case ' ':
+		case '\t':
+			if (!endword(t, &inword, i))
+				return (TOK_ERROR);
+			i++;
+			continue;
+		case '\0':
+		case '\n':
+			i = len;
+			break;
+		case '#':
+			if (!inword) {
+				i = len;
+				break;
+			}
+			if (!tok_append(t, "#", 1))
+				return (TOK_ERROR);
+			i++;
+			continue;
+		case '\'':
+			close = memchr(&line[i + 1], '\'', len - i - 1);
+			if (close == NULL) {
+				fail(t, "unterminated single quote");
+				return (TOK_ERROR);
+			}
+			if (!beginword(t, &inword, i) ||
+			    !tok_append(t, &line[i + 1], close - &line[i + 1]))
+				return (TOK_ERROR);
+			i = close - line + 1;
+			continue;
+		case '"':
+			if (!beginword(t, &inword, i))
+				return (TOK_ERROR);
+			for (i++; i < len && line[i] != '"'; ) {
+				if (line[i] == '\\' && i + 1 < len &&
+				    memchr("$`\"\\\n", line[i + 1], 5) != NULL) {
+					if (line[i + 1] != '\n' &&
+					    !tok_append(t, &line[i + 1], 1))
+						return (TOK_ERROR);
+					i += 2;
+				} else if (line[i] == '$' && i + 1 < len &&
+				    line[i + 1] == '?') {
+					if (t->expand != NULL ?
+					    !t->expand(t, TOK_EXP_STATUS, "?", 1) :
+					    !tok_append(t, "$?", 2))
+						return (TOK_ERROR);
+					i += 2;
+				} else if (line[i] == '$' && i + 1 < len &&
+				    line[i + 1] == '(') {
+					if (!expandcmd(line, len, &i, t, &inword,
+					    true))
+						return (TOK_ERROR);
+				} else {
+					if (line[i] == '$')
+						markdollar(t);
+					for (run = 1; i + run < len &&
+					    memchr("\"\\$", line[i + run], 3) == NULL;
+					    run++)
+						;
+					if (!tok_append(t, &line[i], run))
+						return (TOK_ERROR);
+					i += run;
+				}
+			}
+			if (i >= len) {
+				fail(t, "unterminated double quote");
+				return (TOK_ERROR);
+			}
+			i++;
+			continue;
+		case '\\':
+			if (i + 1 < len && line[i + 1] == '\n') {
+				// A backslash-newline is removed entirely.
+				i += 2;
+				continue;
+			}
+			if (!beginword(t, &inword, i))
+				return (TOK_ERROR);
+			if (i + 1 < len) {
+				if (!tok_append(t, &line[i + 1], 1))
+					return (TOK_ERROR);
+				i += 2;
+			} else {
+				if (!tok_append(t, "\\", 1))
+					return (TOK_ERROR);
+				i++;
+			}
+			continue;
+		case '$':
+			// The output of a command may make no word at all.
+			if (i + 1 < len && line[i + 1] == '(') {
+				if (!expandcmd(line, len, &i, t, &inword, false))
+					return (TOK_ERROR);
+				continue;
+			}
+			if (!beginword(t, &inword, i))
+				return (TOK_ERROR);
+			if (i + 1 < len && line[i + 1] == '?') {
+				if (t->expand != NULL ?
+				    !t->expand(t, TOK_EXP_STATUS, "?", 1) :
+				    !tok_append(t, "$?", 2))
+					return (TOK_ERROR);
+				i += 2;
+			} else {
+				markdollar(t);
+				if (!tok_append(t, "$", 1))
+					return (TOK_ERROR);
+				i++;
+			}
+			continue;
+		case ';':
+			term = TOK_SEQ;
+			break;
+		case '&':
+			term = (i + 1 < len && line[i + 1] == '&') ?
+			    TOK_AND : TOK_BG;
+			break;
+		case '|':
+			term = (i + 1 < len && line[i + 1] == '|') ?
+			    TOK_OR : TOK_PIPE;
+			break;
+		}
+		break;
+	}
+	if (!endword(t, &inword, i))
+		return (TOK_ERROR);
+	t->words[t->nwords] = NULL;
+	// Skips the operator: two bytes for "&&" and "||", otherwise one.
+	if (term == TOK_AND || term == TOK_OR)
+		i += 2;
+	else if (term != TOK_END)
+		i++;
+	*pos = i;
+	return (term);
+}
+
+/*
+ * Requires:
+ *   "s" holds "n" bytes.
+ *
+ * Effects:
+ *   Appends "s" to the word being built in t->arena.  Returns false, after
+ *   setting t->error, if the arena is full.
+ */
+bool
+tok_append(struct Tokens *t, const char *s, size_t n)
+{
+
+	// Leaves room for the word's terminating NUL.
+	if (n >= t->size - t->used)
+		return (fail(t, "command too long"));
+	memcpy(&t->arena[t->used], s, n);
+	t->used += n;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns how many bytes can still be appended to the word being built.
+ */
+size_t
+tok_room(const struct Tokens *t)
+{
+
+	// Leaves room for the word's terminating NUL, as tok_append() does.
+	return (t->used < t->size ? t->size - t->used - 1 : 0);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the widest instruction set that this CPU supports.
+ */
+int
+tok_isa(void)
+{
+
+#ifdef TOK_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return (TOK_ISA_AVX2);
+	if (__builtin_cpu_supports("sse2"))
+		return (TOK_ISA_SSE2);
+#endif
+	return (TOK_ISA_SCALAR);
+}
+
+/*
+ * Requires:
+ *   "isa" is TOK_ISA_SCALAR or an instruction set that tok_isa() reported
+ *   this CPU supports.
+ *
+ * Effects:
+ *   Makes tokenize() classify bytes with "isa".  tokenize() selects one on
+ *   its own, so this is mostly for benchmarks and tests.
+ */
+void
+tok_set_isa(int isa)
+{
+
+	switch (isa) {
+#ifdef TOK_X86
+	case TOK_ISA_AVX2:
+		scan = scan_avx2;
+		break;
+	case TOK_ISA_SSE2:
+		scan = scan_sse2;
+		break;
+#endif
+	default:
+		scan = scan_scalar;
+	}
+}
+
+/*
+ * Requires:
+ *   "p" holds "n" bytes.
+ *
+ * Effects:
+ *   Returns the number of bytes before the first special byte in "p", or
+ *   "n" if there is none.
+ */
+static size_t
+scan_scalar(const char *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n && !special[(unsigned char)p[i]]; i++)
+		;
+	return (i);
+}
+
+#ifdef TOK_X86
+/*
+ * Requires:
+ *   "p" holds "n" bytes, and the CPU supports SSE2.
+ *
+ * Effects:
+ *   Does the same as scan_scalar(), 16 bytes at a time.  Every special byte
+ *   is either at most '\'' or one of ';', '\', and '|', so four compares
+ *   find the candidates, and the few that are not special ('!', '%', and
+ *   control characters) are weeded out with the table.  Never reads past
+ *   the end of "p".
+ */
+__attribute__((target("sse2")))
+static size_t
+scan_sse2(const char *p, size_t n)
+{
+	const __m128i low = _mm_set1_epi8('\'');
+	const __m128i semi = _mm_set1_epi8(';');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i bar = _mm_set1_epi8('|');
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&p[i]);
+		__m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, low), v);
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, semi));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, bslash));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, bar));
+		for (mask = _mm_movemask_epi8(hit); mask != 0;
+		    mask &= mask - 1) {
+			if (special[(unsigned char)p[i + __builtin_ctz(mask)]])
+				return (i + __builtin_ctz(mask));
+		}
+	}
+	return (i + scan_scalar(&p[i], n - i));
+}
+
+/*
+ * Requires:
+ *   "p" holds "n" bytes, and the CPU supports AVX2.
+ *
+ * Effects:
+ *   Does the same as scan_sse2(), 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static size_t
+scan_avx2(const char *p, size_t n)
+{
+	const __m256i low = _mm256_set1_epi8('\'');
+	const __m256i semi = _mm256_set1_epi8(';');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i bar = _mm256_set1_epi8('|');
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&p[i]);
+		__m256i hit = _mm256_cmpeq_epi8(_mm256_min_epu8(v, low), v);
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, semi));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, bslash));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, bar));
+		for (mask = _mm256_movemask_epi8(hit); mask != 0;
+		    mask &= mask - 1) {
+			if (special[(unsigned char)p[i + __builtin_ctz(mask)]])
+				return (i + __builtin_ctz(mask));
+		}
+	}
+	return (i + scan_scalar(&p[i], n - i));
+}
+#endif // TOK_X86
+
+/*
+ * Requires:
+ *   "at" is the offset in the line of the character being added.
+ *
+ * Effects:
+ *   Starts a new word unless one is already being built.  Returns false,
+ *   after setting t->error, if the command has too many words.
+ */
+static bool
+beginword(struct Tokens *t, bool *inword, size_t at)
+{
+
+	if (*inword)
+		return (true);
+	// Leaves room for the word and the terminating NULL.
+	if (t->nwords + 1 >= t->maxwords)
+		return (fail(t, "too many arguments"));
+	if (t->nwords == 0)
+		t->start = at;
+	t->words[t->nwords] = &t->arena[t->used];
+	*inword = true;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "at" is the offset in the line just past the word's last character.
+ *
+ * Effects:
+ *   Terminates the word being built, if any, and adds it to t->words.
+ *   Returns false, after setting t->error, if the arena is full.
+ */
+static bool
+endword(struct Tokens *t, bool *inword, size_t at)
+{
+
+	if (!*inword)
+		return (true);
+	if (t->used == t->size)
+		return (fail(t, "command too long"));
+	t->arena[t->used++] = '\0';
+	t->nwords++;
+	t->end = at;
+	*inword = false;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   line[*pos] is the "$" of a "$(", and "quoted" is whether it is inside
+ *   double quotes.
+ *
+ * Effects:
+ *   Expands the command substitution at line[*pos] and advances "*pos" past
+ *   its ")".  The command's output is left where t->expand put it, after
+ *   the word being built, less its trailing newlines.  Unless "quoted", it
+ *   is then split into words in place: a split never makes the text longer,
+ *   so it needs no second buffer.  NUL bytes are dropped.  Without a
+ *   callback, the "$(...)" is kept as is.  Returns false, after setting
+ *   t->error, if the expansion failed.
+ */
+static bool
+expandcmd(const char *line, size_t len, size_t *pos, struct Tokens *t,
+    bool *inword, bool quoted)
+{
+	size_t close, mark, out, i;
+	char c;
+
+	if ((close = matchparen(line, len, *pos + 2)) == len)
+		return (fail(t, "unterminated $("));
+	if (t->expand == NULL) {
+		if (!beginword(t, inword, *pos) ||
+		    !tok_append(t, &line[*pos], close + 1 - *pos))
+			return (false);
+		*pos = close + 1;
+		return (true);
+	}
+	mark = t->used;
+	if (!t->expand(t, TOK_EXP_COMMAND, &line[*pos + 2],
+	    close - *pos - 2))
+		return (false);
+	for (out = t->used; out > mark && t->arena[out - 1] == '\n'; out--)
+		;
+
+	// Rewrites the output over itself; t->used never passes i.
+	t->used = mark;
+	for (i = mark; i < out; i++) {
+		c = t->arena[i];
+		if (c == '\0')
+			continue;
+		if (!quoted && (c == ' ' || c == '\t' || c == '\n')) {
+			if (!endword(t, inword, close + 1))
+				return (false);
+		} else {
+			if (!beginword(t, inword, *pos))
+				return (false);
+			t->arena[t->used++] = c;
+		}
+	}
+	*pos = close + 1;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "error" is a properly terminated string.
+ *
+ * Effects:
+ *   Records "error" in "t" and returns false.
+ */
+static bool
+fail(struct Tokens *t, const char *error)
+{
+
+	t->error = error;
+	return (false);
+}
+
+/*
+ * Requires:
+ *   A '$' is about to be appended to the arena of "t".
+ *
+ * Effects:
+ *   Records the arena offset of that '$' if "t" asks for it and has room.
+ */
+static void
+markdollar(struct Tokens *t)
+{
+
+	if (t->dollars != NULL && t->ndollars < t->maxdollars)
+		t->dollars[t->ndollars++] = t->used;
+}
+
+/*
+ * Requires:
+ *   "line" holds "len" bytes, and "i" is just past a "$(".
+ *
+ * Effects:
+ *   Returns the offset of the ")" that closes the "$(", skipping quoted
+ *   text and nested parentheses, or "len" if there is none.
+ */
+static size_t
+matchparen(const char *line, size_t len, size_t i)
+{
+	const char *close;
+	int depth = 1;
+
+	for (; i < len; i++) {
+		switch (line[i]) {
+		case '\\':
+			i++;
+			break;
+		case '\'':
+			close = memchr(&line[i + 1], '\'', len - i - 1);
+			if (close == NULL)
+				return (len);
+			i = close - line;
+			break;
+		case '"':
+			for (i++; i < len && line[i] != '"'; i++)
+				if (line[i] == '\\')
+					i++;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (--depth == 0)
+				return (i);
+			break;
+		}
+	}
+	return (len);
+}
@@ -0,0 +1,72 @@
+/*
+ * parse.h - Command line tokenizer for the tiny shell.
+ *
+ * tokenize() splits one command of a command line into words, handling
+ * blanks, single quotes, double quotes, backslash escapes, "#" comments,
+ * and "$?" and "$(command)" expansions.  It stops at the operator that
+ * ends the command, so that a list such as "a && b" is tokenized one
+ * command at a time, each right before it runs.
+ */
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// What ended a command, as returned by tokenize():
+#define TOK_ERROR (-1)  // syntax error; see Tokens.error
+#define TOK_END   0     // end of the line
+#define TOK_SEQ   1     // ";"
+#define TOK_BG    2     // "&"
+#define TOK_AND   3     // "&&"
+#define TOK_OR    4     // "||"
+#define TOK_PIPE  5     // "|"
+
+// Instruction sets that tokenize() can classify bytes with:
+#define TOK_ISA_SCALAR 0        // one byte at a time
+#define TOK_ISA_SSE2   1        // 16 bytes at a time
+#define TOK_ISA_AVX2   2        // 32 bytes at a time
+
+// What tok_expand_fn is asked to expand:
+#define TOK_EXP_STATUS  0       // "$?"
+#define TOK_EXP_COMMAND 1       // "$(command)", to the command's output
+
+struct Tokens;
+
+/*
+ * Expands "$?" or, for TOK_EXP_COMMAND, "$(text)", where "text" is "len"
+ * bytes long, by appending the result with tok_append() or by writing up
+ * to tok_room() bytes at arena + used and adding their number to used.
+ * tokenize() then drops a command's trailing newlines and, outside double
+ * quotes, splits its output into words.  Returns false, after setting
+ * Tokens.error, if the expansion failed.
+ */
+typedef bool	tok_expand_fn(struct Tokens *t, int kind, const char *text,
+		    size_t len);
+
+// The caller-provided storage and results of tokenize().
+struct Tokens {
+	char **words;           // the words, NULL-terminated (an argv)
+	int maxwords;           // capacity of words, including the NULL
+	int nwords;             // number of words
+	char *arena;            // storage for the words' text
+	size_t size;            // capacity of arena
+	size_t used;            // bytes of arena in use
+	size_t start;           // offset of the command's first word
+	size_t end;             // offset just past the command's last word
+	tok_expand_fn *expand;  // expands "$?" and "$(...)"; NULL keeps them
+	void *ctx;              // for use by expand
+	size_t *dollars;        // if not NULL, gets the arena offset of each
+	int maxdollars;         // '$' that was neither single-quoted nor
+	int ndollars;           // escaped, up to maxdollars of them
+	const char *error;      // why tokenize() returned TOK_ERROR
+};
+
+int	tokenize(const char *line, size_t len, size_t *pos, struct Tokens *t);
+bool	tok_append(struct Tokens *t, const char *s, size_t n);
+size_t	tok_room(const struct Tokens *t);
+int	tok_isa(void);
+void	tok_set_isa(int isa);
+
+#endif // PARSE_H
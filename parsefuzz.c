@@ -0,0 +1,184 @@
+/*
+ * parsefuzz.c - Differential fuzzer for the tiny shell's tokenizer.
+ *
+ * usage: parsefuzz [n] [seed]
+ *
+ * Generates n random command lines from the subset of the syntax that the
+ * original parseline() understood (plain words, whole single-quoted words,
+ * spaces, and a trailing "&"), and checks that tokenize() splits each one
+ * into the same words, with every instruction set this CPU supports.
+ * Prints the first line that differs and exits with status 1, or exits
+ * with status 0 if all of them agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+
+#define MAXLINE 1024
+#define MAXARGS 128
+
+static bool	check(const char *line);
+static void	genline(char *line);
+static bool	parseline(const char *cmdline, char **argv);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Runs the fuzzer for the number of lines given on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	char line[MAXLINE];
+	long i, n = argc > 1 ? atol(argv[1]) : 1000000;
+	unsigned int seed = argc > 2 ? (unsigned int)atol(argv[2]) : 1;
+
+	if (n <= 0) {
+		fprintf(stderr, "Usage: parsefuzz [n] [seed]\n");
+		exit(1);
+	}
+	srandom(seed);
+	for (i = 0; i < n; i++) {
+		genline(line);
+		if (!check(line)) {
+			printf("parsefuzz: mismatch on line %ld: %s", i, line);
+			exit(1);
+		}
+	}
+	printf("parsefuzz: %ld lines agree (seed %u)\n", n, seed);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "line" has room for MAXLINE bytes.
+ *
+ * Effects:
+ *   Writes a random newline-terminated command line to "line".  Words are
+ *   drawn from bytes that neither parser treats specially; a single-quoted
+ *   word only has blanks inside it.  Lines sometimes start or end with
+ *   extra spaces and sometimes end with " &".
+ */
+static void
+genline(char *line)
+{
+	static const char plain[] = "abcdefghijklmnopqrstuvwxyz"
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_./,:=+%@^*~";
+	static const char quoted[] = "abcxyz019-_./ ";
+	int i, j, nwords = random() % 12, len;
+	char *p = line;
+
+	p += sprintf(p, "%*s", (int)(random() % 3), "");
+	for (i = 0; i < nwords; i++) {
+		len = 1 + random() % 24;
+		if (random() % 4 == 0) {
+			*p++ = '\'';
+			for (j = 0; j < len; j++)
+				*p++ = quoted[random() % (sizeof(quoted) - 1)];
+			*p++ = '\'';
+		} else {
+			for (j = 0; j < len; j++)
+				*p++ = plain[random() % (sizeof(plain) - 1)];
+		}
+		p += sprintf(p, "%*s", 1 + (int)(random() % 3), "");
+	}
+	if (random() % 4 == 0)
+		p += sprintf(p, "&");
+	sprintf(p, "\n");
+}
+
+/*
+ * Requires:
+ *   "line" is a newline-terminated command line from genline().
+ *
+ * Effects:
+ *   Returns true if tokenize() produces the same words and background flag
+ *   as parseline() for "line" with every supported instruction set.
+ */
+static bool
+check(const char *line)
+{
+	char *want[MAXARGS], *argv[MAXARGS], arena[2 * MAXLINE];
+	struct Tokens t = { .words = argv, .maxwords = MAXARGS,
+	    .arena = arena, .size = sizeof(arena) };
+	bool bg = parseline(line, want);
+	size_t pos;
+	int isa, i, term;
+
+	// parseline() calls a blank line a background job.
+	if (want[0] == NULL && strchr(line, '&') == NULL)
+		bg = false;
+
+	for (isa = TOK_ISA_SCALAR; isa <= tok_isa(); isa++) {
+		tok_set_isa(isa);
+		pos = 0;
+		term = tokenize(line, strlen(line), &pos, &t);
+		if (term != (bg ? TOK_BG : TOK_END))
+			return (false);
+		for (i = 0; want[i] != NULL && argv[i] != NULL; i++)
+			if (strcmp(want[i], argv[i]) != 0)
+				return (false);
+		if (want[i] != NULL || argv[i] != NULL)
+			return (false);
+	}
+	return (true);
+}
+
+/*
+ * parseline - The tiny shell's original command line parser, kept
+ * verbatim as the reference.
+ */
+static bool
+parseline(const char *cmdline, char **argv)
+{
+	int argc;                   // number of args
+	static char array[MAXLINE]; // local copy of command line
+	char *buf = array;          // ptr that traverses command line
+	char *delim;                // points to first space delimiter
+	bool bg;                    // background job?
+
+	strcpy(buf, cmdline);
+
+	// Replace trailing '\n' with space.
+	buf[strlen(buf) - 1] = ' ';
+
+	// Ignore leading spaces.
+	while (*buf != '\0' && *buf == ' ')
+		buf++;
+
+	// Build the argv list.
+	argc = 0;
+	if (*buf == '\'') {
+		buf++;
+		delim = strchr(buf, '\'');
+	} else
+		delim = strchr(buf, ' ');
+	while (delim != NULL) {
+		argv[argc++] = buf;
+		*delim = '\0';
+		buf = delim + 1;
+		while (*buf != '\0' && *buf == ' ')	// Ignore spaces.
+			buf++;
+		if (*buf == '\'') {
+			buf++;
+			delim = strchr(buf, '\'');
+		} else
+			delim = strchr(buf, ' ');
+	}
+	argv[argc] = NULL;
+
+	// Ignore blank line.
+	if (argc == 0)
+		return (true);
+
+	// Should the job run in the background?
+	if ((bg = (*argv[argc - 1] == '&')) != 0)
+		argv[--argc] = NULL;
+
+	return (bg);
+}
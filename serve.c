@@ -0,0 +1,150 @@
+/*
+ * serve.c - Framing for the protocol between "tsh --serve" and its clients.
+ *
+ * Used by both ends.  srv_send() is async-signal-safe, so that a client
+ * can forward ctrl-c from its signal handler.
+ */
+
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+/*
+ * Requires:
+ *   "data" holds "len" bytes, at most SRV_MAXFRAME - SRV_HEADER, and "fds"
+ *   holds "nfds" descriptors, at most 3.
+ *
+ * Effects:
+ *   Sends one frame of the given type and payload on "sock", passing the
+ *   descriptors in "fds" along with it.  Does not block.  Returns false if
+ *   the whole frame could not be sent, in which case the connection is no
+ *   longer usable.
+ */
+bool
+srv_send(int sock, int type, const void *data, size_t len, const int *fds,
+    int nfds)
+{
+	char frame[SRV_MAXFRAME];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	uint32_t n = htonl(len + 1);
+	ssize_t sent;
+
+	if (len > SRV_MAXFRAME - SRV_HEADER || nfds > 3)
+		return (false);
+	memcpy(frame, &n, 4);
+	frame[4] = type;
+	if (len > 0)
+		memcpy(&frame[SRV_HEADER], data, len);
+	iov.iov_base = frame;
+	iov.iov_len = SRV_HEADER + len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	do
+		sent = sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	while (sent < 0 && errno == EINTR);
+	return (sent == (ssize_t)iov.iov_len);
+}
+
+/*
+ * Requires:
+ *   "buf" has room for "size" bytes and "fds" for "maxfds" descriptors.
+ *
+ * Effects:
+ *   Reads what is available on "sock", blocking only if the socket does,
+ *   into "buf", and any descriptors passed with it into "fds", setting
+ *   "nfds" to their number.  Descriptors beyond "maxfds" are closed.
+ *   Returns the number of bytes read, 0 at end of file, or -1 on error.
+ */
+ssize_t
+srv_recv(int sock, char *buf, size_t size, int *fds, int maxfds, int *nfds)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(8 * sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base = buf, .iov_len = size };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	int i, count, fd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	*nfds = 0;
+	do
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return (-1);
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; i++) {
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+			    sizeof(int));
+			if (*nfds < maxfds)
+				fds[(*nfds)++] = fd;
+			else
+				close(fd);
+		}
+	}
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "buf" holds "len" bytes received from a peer.
+ *
+ * Effects:
+ *   If "buf" starts with a whole frame, sets "type", "payload", and "plen"
+ *   to its type and payload and returns its size.  Returns 0 if more bytes
+ *   are needed, and -1 if the frame is malformed.
+ */
+ssize_t
+srv_frame(const char *buf, size_t len, int *type, const char **payload,
+    size_t *plen)
+{
+	uint32_t n;
+
+	if (len < 4)
+		return (0);
+	memcpy(&n, buf, 4);
+	n = ntohl(n);
+	if (n < 1 || n > SRV_MAXFRAME - 4)
+		return (-1);
+	if (len < 4 + n)
+		return (0);
+	*type = (unsigned char)buf[4];
+	*payload = &buf[SRV_HEADER];
+	*plen = n - 1;
+	return (4 + n);
+}
@@ -0,0 +1,47 @@
+/*
+ * serve.h - The protocol between "tsh --serve" and its clients.
+ *
+ * A client connects to the server's Unix domain socket and exchanges
+ * frames with it.  A frame is a 4-byte length in network byte order,
+ * counting the type byte and the payload, then a type byte, then the
+ * payload.  The client's first frame is SRV_HELLO, which carries its
+ * stdin, stdout, and stderr as SCM_RIGHTS descriptors.  The server runs
+ * the client's jobs on those descriptors, so their output never passes
+ * through the socket, but sends the shell's own output for the client,
+ * such as that of builtins and job notifications, in SRV_OUT frames, so
+ * that a client that stops reading never blocks the server.  Before
+ * starting a job after such output, the server sends SRV_SYNC, and the
+ * client answers SRV_SYNC once it has written all the output before it.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SRV_HEADER   5          // length and type bytes
+#define SRV_MAXFRAME 1100       // max frame size, including the header
+
+// Frame types, from the client:
+#define SRV_HELLO  'H'  // first frame, with the client's stdin, stdout, stderr
+#define SRV_CMD    'C'  // a command line to evaluate
+#define SRV_SIGNAL 'S'  // payload: one byte, SIGINT or SIGTSTP for the fg job
+
+// Frame types, from the server:
+#define SRV_DONE   'D'  // the line finished; payload: one byte, its status
+#define SRV_BYE    'B'  // the session ended with quit
+#define SRV_OUT    'O'  // payload: the shell's output, for the client's stdout
+
+// Frame types, from both:
+#define SRV_SYNC   'Y'  // the output before it is written, or must be
+
+bool	srv_send(int sock, int type, const void *data, size_t len,
+	    const int *fds, int nfds);
+ssize_t	srv_recv(int sock, char *buf, size_t size, int *fds, int maxfds,
+	    int *nfds);
+ssize_t	srv_frame(const char *buf, size_t len, int *type,
+	    const char **payload, size_t *plen);
+
+#endif // SERVE_H
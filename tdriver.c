@@ -0,0 +1,640 @@
+/*
+ * tdriver.c - Trace driver that runs the whole trace suite in parallel.
+ *
+ * usage: tdriver [-hgv] [-s shell] [-a args] [trace ...]
+ *
+ * Runs the shell (./tsh by default) on every trace file named on the
+ * command line, or on every traceNN.txt in the current directory, all at
+ * once.  The trace format is that of sdriver.pl: "#" lines are comments,
+ * blank lines are ignored, the lines TSTP, INT, QUIT, KILL, CLOSE, WAIT,
+ * and "SLEEP <n>" are driver commands, and every other line is sent to the
+ * shell.  As with sdriver.pl, a trace's output is its comments followed by
+ * everything the shell wrote to stdout.
+ *
+ * Each shell runs in its own session, so that the signals of one trace
+ * never reach another.  The output is normalized before it is compared:
+ * every "(pid)" becomes "(PID)", and each row printed by ps is reduced to
+ * its state and command, or dropped if the process is not part of the
+ * trace's own session.  The driver is a child subreaper, so the processes
+ * that a trace orphans stay visible in /proc until every trace is done.
+ *
+ * The normalized output of trace "traceNN.txt" is compared against
+ * "traceNN.out".  With -g the expected files are (re)written instead.
+ * Prints each trace's result and wall time, and exits with status 1 if any
+ * trace failed.
+ */
+
+#define _GNU_SOURCE // for pipe2()
+
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXARGS   32    // max shell arguments
+#define MAXTRACES 256   // max traces run at once
+#define MAXLINE   1024  // max line of shell output
+
+// A growable string.
+struct Buf {
+	char *s;
+	size_t len;
+	size_t cap;
+};
+
+// A trace being run.
+struct Trace {
+	const char *name;       // trace file name
+	char *text;             // trace file contents
+	char *next;             // next line of text to run
+	pid_t pid;              // the shell, or 0 once reaped
+	int in;                 // shell's stdin, or -1 once closed
+	int out;                // shell's stdout, or -1 at EOF
+	double wake;            // time that a SLEEP ends
+	bool waiting;           // in a WAIT for the shell to exit
+	double start;           // when the trace started
+	double secs;            // wall time, once done
+	struct Buf comments;    // the comment lines
+	struct Buf output;      // the shell's normalized output
+	char line[MAXLINE];     // partial line of output
+	size_t linelen;         // length of line
+};
+
+static const char *shell = "./tsh";	// shell under test
+static char *shellargv[MAXARGS];	// shell and its arguments
+static bool verbose = false;		// print failing traces' output
+
+static void	advance(struct Trace *t);
+static void	append(struct Buf *b, const char *s, size_t n);
+static bool	check(struct Trace *t, bool generate);
+static void	finish(struct Trace *t);
+static char *	expected_name(const char *name);
+static void	normalize(struct Trace *t, const char *line);
+static double	now(void);
+static bool	psrow(const char *line, pid_t *pid, char *state,
+		    const char **cmd);
+static char *	readfile(const char *name, size_t *len);
+static bool	session_of(pid_t pid, pid_t sid);
+static void	start(struct Trace *t);
+static void	unix_error(const char *msg);
+static void	usage(void);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Runs the traces and reports the results.
+ */
+int
+main(int argc, char **argv)
+{
+	static struct Trace traces[MAXTRACES];
+	struct pollfd fds[MAXTRACES];
+	struct Trace *polled[MAXTRACES];
+	const char *args = "-p";
+	bool generate = false, failed = false;
+	double timeout, begin = now();
+	glob_t g = { 0 };
+	int c, i, n, nfds, ntraces, running;
+	char buf[4096], *word;
+	ssize_t len;
+
+	while ((c = getopt(argc, argv, "hgvs:a:")) != -1) {
+		switch (c) {
+		case 'g':             // Write the expected output files.
+			generate = true;
+			break;
+		case 'v':             // Print the output of failing traces.
+			verbose = true;
+			break;
+		case 's':             // Use a different shell.
+			shell = optarg;
+			break;
+		case 'a':             // Pass different arguments to the shell.
+			args = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	// Splits the shell's arguments on blanks.
+	char *argcopy = strdup(args);
+	shellargv[0] = (char *)shell;
+	for (n = 1, word = strtok(argcopy, " \t"); word != NULL &&
+	    n < MAXARGS - 1; word = strtok(NULL, " \t"))
+		shellargv[n++] = word;
+	shellargv[n] = NULL;
+
+	if (optind == argc) {
+		if (glob("trace[0-9][0-9].txt", 0, NULL, &g) != 0)
+			usage();
+		argc = g.gl_pathc;
+		argv = g.gl_pathv;
+		optind = 0;
+	}
+	if ((ntraces = argc - optind) > MAXTRACES)
+		ntraces = MAXTRACES;
+
+	/*
+	 * Orphaned processes are reparented to the driver and stay zombies
+	 * until the end, so their session can still be looked up.
+	 */
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+		unix_error("prctl error");
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < ntraces; i++) {
+		traces[i].name = argv[optind + i];
+		start(&traces[i]);
+	}
+	for (running = ntraces; running > 0; ) {
+		timeout = -1;
+		nfds = 0;
+		for (i = 0; i < ntraces; i++) {
+			struct Trace *t = &traces[i];
+			advance(t);
+			if (t->out < 0)
+				continue;
+			if (t->waiting)
+				timeout = 0.01;
+			else if (t->wake > 0 && (timeout < 0 ||
+			    t->wake - now() < timeout))
+				timeout = t->wake - now();
+			fds[nfds].fd = t->out;
+			fds[nfds].events = POLLIN;
+			polled[nfds++] = t;
+		}
+		if (poll(fds, nfds, timeout < 0 ? -1 : (int)(timeout * 1000) +
+		    1) < 0 && errno != EINTR)
+			unix_error("poll error");
+		for (i = 0; i < nfds; i++) {
+			struct Trace *t = polled[i];
+			if (fds[i].revents == 0)
+				continue;
+			if ((len = read(t->out, buf, sizeof(buf))) > 0) {
+				for (c = 0; c < len; c++) {
+					// Truncates overlong lines, such as ps rows.
+					if (buf[c] != '\n') {
+						if (t->linelen < MAXLINE - 1)
+							t->line[t->linelen++] =
+							    buf[c];
+						continue;
+					}
+					t->line[t->linelen] = '\0';
+					normalize(t, t->line);
+					t->linelen = 0;
+				}
+			} else if (len == 0 || errno != EINTR) {
+				finish(t);
+				running--;
+			}
+		}
+	}
+
+	for (i = 0; i < ntraces; i++)
+		if (!check(&traces[i], generate))
+			failed = true;
+	printf("%d traces in %.2f s\n", ntraces, now() - begin);
+
+	// Reaps the orphans.
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	globfree(&g);
+	free(argcopy);
+	return (failed ? 1 : 0);
+}
+
+/*
+ * Requires:
+ *   "t" has been started.
+ *
+ * Effects:
+ *   Carries out the lines of the trace, up to the next one that must wait:
+ *   a SLEEP that has not ended, or a WAIT for a shell that has not exited.
+ *   Closes the shell's stdin after the last line.
+ */
+static void
+advance(struct Trace *t)
+{
+	char *line, *end, cmd[MAXLINE + 1];
+	int n, secs;
+
+	if (t->waiting) {
+		if (waitpid(t->pid, NULL, WNOHANG) == 0)
+			return;
+		t->pid = 0;
+		t->waiting = false;
+	}
+	if (t->wake > 0) {
+		if (now() < t->wake)
+			return;
+		t->wake = 0;
+	}
+	while (t->next != NULL && *t->next != '\0') {
+		line = t->next;
+		if ((end = strchr(line, '\n')) != NULL) {
+			*end = '\0';
+			t->next = end + 1;
+		} else
+			t->next = NULL;
+
+		if (line[0] == '#') {
+			append(&t->comments, line, strlen(line));
+			append(&t->comments, "\n", 1);
+		} else if (line[strspn(line, " \t\r")] == '\0') {
+			continue;
+		} else if (strcmp(line, "TSTP") == 0) {
+			kill(t->pid, SIGTSTP);
+		} else if (strcmp(line, "INT") == 0) {
+			kill(t->pid, SIGINT);
+		} else if (strcmp(line, "QUIT") == 0) {
+			kill(t->pid, SIGQUIT);
+		} else if (strcmp(line, "KILL") == 0) {
+			kill(t->pid, SIGKILL);
+		} else if (strcmp(line, "CLOSE") == 0) {
+			if (t->in >= 0)
+				close(t->in);
+			t->in = -1;
+		} else if (strcmp(line, "WAIT") == 0) {
+			if (t->pid != 0) {
+				t->waiting = true;
+				advance(t);
+				return;
+			}
+		} else if (sscanf(line, "SLEEP %d", &secs) == 1) {
+			t->wake = now() + secs;
+			return;
+		} else if (t->in >= 0) {
+			n = snprintf(cmd, sizeof(cmd), "%s\n", line);
+			if (write(t->in, cmd, n) < 0 && errno != EPIPE)
+				unix_error("write error");
+		}
+	}
+	if (t->in >= 0) {
+		close(t->in);
+		t->in = -1;
+	}
+}
+
+/*
+ * Requires:
+ *   "s" holds "n" bytes.
+ *
+ * Effects:
+ *   Appends "s" to "b".
+ */
+static void
+append(struct Buf *b, const char *s, size_t n)
+{
+
+	if (b->len + n + 1 > b->cap) {
+		b->cap = 2 * (b->len + n + 1);
+		if ((b->s = realloc(b->s, b->cap)) == NULL)
+			unix_error("realloc error");
+	}
+	memcpy(&b->s[b->len], s, n);
+	b->len += n;
+	b->s[b->len] = '\0';
+}
+
+/*
+ * Requires:
+ *   "t" is done.
+ *
+ * Effects:
+ *   Compares the trace's output against its expected output, or writes the
+ *   expected output if "generate" is true, and prints the result.  Returns
+ *   false if the output differs.
+ */
+static bool
+check(struct Trace *t, bool generate)
+{
+	char *name = expected_name(t->name), *want;
+	const char *got, *w, *g;
+	size_t len;
+	FILE *fp;
+	int line;
+
+	append(&t->comments, t->output.s != NULL ? t->output.s : "",
+	    t->output.len);
+	got = t->comments.s != NULL ? t->comments.s : "";
+	if (generate) {
+		if ((fp = fopen(name, "w")) == NULL ||
+		    fputs(got, fp) == EOF || fclose(fp) != 0)
+			unix_error(name);
+		printf("%-12s wrote %-12s %6.2f s\n", t->name, name, t->secs);
+		free(name);
+		return (true);
+	}
+	if ((want = readfile(name, &len)) == NULL) {
+		printf("%-12s FAIL  no %s\n", t->name, name);
+		free(name);
+		return (false);
+	}
+	free(name);
+	if (strcmp(want, got) == 0) {
+		printf("%-12s ok    %6.2f s\n", t->name, t->secs);
+		free(want);
+		return (true);
+	}
+
+	// Finds the first line that differs.
+	for (w = want, g = got, line = 1; ; line++) {
+		size_t wl = strcspn(w, "\n"), gl = strcspn(g, "\n");
+		if (wl != gl || strncmp(w, g, wl) != 0) {
+			printf("%-12s FAIL  %6.2f s, line %d\n", t->name,
+			    t->secs, line);
+			printf("    expected: %.*s\n", (int)wl, w);
+			printf("    got:      %.*s\n", (int)gl, g);
+			break;
+		}
+		w += wl + (w[wl] != '\0');
+		g += gl + (g[gl] != '\0');
+	}
+	if (verbose)
+		printf("%s", got);
+	free(want);
+	return (false);
+}
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the malloc()ed name of the expected output file of trace
+ *   "name": "name" with ".txt" replaced by ".out".
+ */
+static char *
+expected_name(const char *name)
+{
+	size_t len = strlen(name);
+	char *out = malloc(len + 5);
+
+	if (out == NULL)
+		unix_error("malloc error");
+	if (len > 4 && strcmp(&name[len - 4], ".txt") == 0)
+		len -= 4;
+	sprintf(out, "%.*s.out", (int)len, name);
+	return (out);
+}
+
+/*
+ * Requires:
+ *   The shell's stdout has reached EOF.
+ *
+ * Effects:
+ *   Normalizes any unterminated last line, reaps the shell, and records the
+ *   trace's wall time.
+ */
+static void
+finish(struct Trace *t)
+{
+
+	if (t->linelen > 0) {
+		t->line[t->linelen] = '\0';
+		normalize(t, t->line);
+		t->linelen = 0;
+	}
+	close(t->out);
+	t->out = -1;
+	if (t->pid != 0 && waitpid(t->pid, NULL, 0) < 0)
+		unix_error("waitpid error");
+	t->pid = 0;
+	t->secs = now() - t->start;
+}
+
+/*
+ * Requires:
+ *   "line" is a line of the shell's output, without its newline.
+ *
+ * Effects:
+ *   Appends the normalized line to the trace's output.  Replaces every
+ *   "(digits)" with "(PID)".  A ps row is replaced by its state (T for
+ *   stopped, Z for a zombie, and R otherwise) and command, unless the
+ *   process is ps itself, the shell, or a process of another session, in
+ *   which case it is dropped.
+ */
+static void
+normalize(struct Trace *t, const char *line)
+{
+	const char *cmd, *p;
+	char state;
+	pid_t pid;
+	size_t n;
+
+	if (psrow(line, &pid, &state, &cmd)) {
+		if (pid == t->pid || strncmp(cmd, "/bin/ps", 7) == 0 ||
+		    strncmp(cmd, "ps ", 3) == 0 || !session_of(pid, t->pid))
+			return;
+		state = state == 'T' || state == 'Z' ? state : 'R';
+		append(&t->output, &state, 1);
+		append(&t->output, " ", 1);
+		append(&t->output, cmd, strlen(cmd));
+		append(&t->output, "\n", 1);
+		return;
+	}
+	for (p = line; *p != '\0'; p += n) {
+		if (p[0] == '(' && isdigit((unsigned char)p[1])) {
+			n = 1 + strspn(&p[1], "0123456789");
+			if (p[n] == ')') {
+				append(&t->output, "(PID)", 5);
+				n++;
+				continue;
+			}
+		}
+		n = 1 + strcspn(&p[1], "(");
+		append(&t->output, p, n);
+	}
+	append(&t->output, "\n", 1);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the current CLOCK_MONOTONIC time in seconds.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Requires:
+ *   "line" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns true if "line" is a row of "ps" output in its default format,
+ *   "PID TTY STAT TIME COMMAND", and stores its PID, the first letter of
+ *   its STAT, and its COMMAND.
+ */
+static bool
+psrow(const char *line, pid_t *pid, char *state, const char **cmd)
+{
+	const char *p = line + strspn(line, " ");
+	size_t n;
+
+	if ((n = strspn(p, "0123456789")) == 0 || p[n] != ' ')
+		return (false);
+	*pid = atoi(p);
+	p += n + strspn(&p[n], " ");
+	p += strcspn(p, " ");           // TTY
+	p += strspn(p, " ");
+	*state = *p;
+	p += strcspn(p, " ");           // STAT
+	p += strspn(p, " ");
+	n = strcspn(p, " ");            // TIME
+	if (n == 0 || memchr(p, ':', n) == NULL)
+		return (false);
+	p += n + strspn(&p[n], " ");
+	*cmd = p;
+	return (*state != '\0');
+}
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the malloc()ed, NUL-terminated contents of the file "name" and
+ *   stores their length in "len", or returns NULL if it cannot be read.
+ */
+static char *
+readfile(const char *name, size_t *len)
+{
+	struct Buf b = { NULL, 0, 0 };
+	char buf[4096];
+	size_t n;
+	FILE *fp;
+
+	if ((fp = fopen(name, "r")) == NULL)
+		return (NULL);
+	append(&b, "", 0);
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		append(&b, buf, n);
+	fclose(fp);
+	*len = b.len;
+	return (b.s);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns true if process "pid" exists, possibly as a zombie, and is in
+ *   session "sid".
+ */
+static bool
+session_of(pid_t pid, pid_t sid)
+{
+	char path[64], stat[512], *p;
+	int session;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (false);
+	p = fgets(stat, sizeof(stat), fp);
+	fclose(fp);
+	// The command name may hold spaces, so fields are counted after it.
+	if (p == NULL || (p = strrchr(stat, ')')) == NULL ||
+	    sscanf(p, ") %*c %*d %*d %d", &session) != 1)
+		return (false);
+	return (session == sid);
+}
+
+/*
+ * Requires:
+ *   t->name is the name of a trace file.
+ *
+ * Effects:
+ *   Reads the trace and starts the shell for it in a new session, with its
+ *   stdin and stdout on pipes.  The shell's stderr is left alone, as
+ *   sdriver.pl does.
+ */
+static void
+start(struct Trace *t)
+{
+	int in[2], out[2];
+	size_t len;
+
+	if ((t->text = readfile(t->name, &len)) == NULL)
+		unix_error(t->name);
+	t->next = t->text;
+	// Keeps the other traces' shells from holding these pipes open.
+	if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+		unix_error("pipe error");
+	t->start = now();
+	if ((t->pid = fork()) < 0)
+		unix_error("fork error");
+	if (t->pid == 0) {
+		setsid();
+		if (dup2(in[0], STDIN_FILENO) < 0 ||
+		    dup2(out[1], STDOUT_FILENO) < 0)
+			unix_error("dup2 error");
+		signal(SIGPIPE, SIG_DFL);
+		execv(shell, shellargv);
+		unix_error(shell);
+	}
+	close(in[0]);
+	close(out[1]);
+	t->in = in[1];
+	t->out = out[0];
+}
+
+/*
+ * Requires:
+ *   "msg" is a properly terminated string.
+ *
+ * Effects:
+ *   Prints a Unix-style error message and terminates the program.
+ */
+static void
+unix_error(const char *msg)
+{
+
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Prints a help message and terminates the program.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: tdriver [-hgv] [-s shell] [-a args] "
+	    "[trace ...]\n");
+	fprintf(stderr, "   -h         print this message\n");
+	fprintf(stderr, "   -g         write the expected output files\n");
+	fprintf(stderr, "   -v         print the output of failing traces\n");
+	fprintf(stderr, "   -s shell   shell to test (default ./tsh)\n");
+	fprintf(stderr, "   -a args    shell arguments (default \"-p\")\n");
+	exit(1);
+}
@@ -6,24 +6,64 @@
  * Liam Ruiz-Steblein ldr3, Jared Duran jad21
  */
 
+#define _GNU_SOURCE // for execveat(), pipe2(), O_PATH, and ppoll()
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
+#include <linux/sched.h>    // for clone3() and CLONE_INTO_CGROUP
+
+#include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "builtins.h"
+#include "joblog.h"
+#include "parse.h"
+#include "serve.h"
+
 // You may assume that these constants are large enough.
 #define MAXLINE      1024   // max line size
 #define MAXARGS       128   // max args on a command line
 #define MAXJOBS        16   // max jobs at any point in time
 #define MAXJID   (1 << 16)  // max job ID
+#define INBUFSIZE   65536   // bytes read from the input at a time
+#define MAXSOURCE      16   // max nesting of the source command
+#define POOLSIZE        4   // pre-forked helpers kept by the pool option
+#define OUTBUFSIZE   4096   // bytes of output kept per captured job
+#define CPUPERIOD  100000   // cpu.max period of a limited job, in usec
+#define NRLIMITS        5   // rlimits that ulimit, limit, and prlimit set
+#define MAXCLIENTS   1024   // max clients of --serve at once
+#define MAXOUTPUT (1 << 20) // max bytes queued for a --serve client
+#define MAXSUBST    65536   // max bytes of "$(...)" output per command
+#define NOTESIZE     4096   // bytes of job notifications held back
+#define MAXMEMBERS    256   // processes jstat follows besides the leaders
+
+// Indexes of the rlimits in rlimits[] and Limits.rlim:
+#define RL_AS     0
+#define RL_CPU    1
+#define RL_NOFILE 2
+#define RL_NPROC  3
+#define RL_CORE   4
 
 // The job states are:
 #define UNDEF 0 // undefined
@@ -45,15 +85,44 @@ struct Job {
 	int jid;                // job ID [1, 2, ...]
 	int state;              // UNDEF, FG, BG, or ST
 	char cmdline[MAXLINE];  // command line
+	int statfd;             // cached /proc/<pid>/stat descriptor or -1
+	int statmfd;            // cached /proc/<pid>/statm descriptor or -1
+	int childfd;            // cached /proc/<pid>/task/<pid>/children
+	                        // descriptor or -1
+	unsigned long long cputicks;	// utime + stime at the last jstat sample
+	long long sampled;      // CLOCK_MONOTONIC ns of the last jstat sample
+	int cgfd;               // the job's own cgroup directory or -1
+	char cgname[32];        // the name of that cgroup under cgroot
+	bool rlimited;          // limited with setrlimit() instead of a cgroup
+	int client;             // index of the --serve client that started it
+	                        // or -1
 };
 typedef volatile struct Job *JobP;
 
+// What jstat adds up over the processes in a job's group besides the leader.
+struct Members {
+	int procs;              // number of processes
+	long threads;           // their threads
+	unsigned long long ticks;	// their utime + stime
+	long pages;             // their resident pages
+};
+
+// A process in a job's group besides the leader, followed by jstat.
+struct Member {
+	pid_t pid;              // its PID, or 0 if the slot is free
+	pid_t pgid;             // the group, which is the job leader's PID
+	int statfd;             // its /proc/<pid>/stat descriptor
+	int childfd;            // its /proc/<pid>/task/<pid>/children one
+	bool parent;            // whether it has had children
+};
+
 
 /*
  * Define the jobs list using the "volatile" qualifier because it is accessed
  * by a signal handler (as well as the main program).
  */
 static volatile struct Job jobs[MAXJOBS];
+static struct Member followed[MAXMEMBERS]; // jstat's members of the jobs
 static int nextjid = 1;            // next job ID to allocate
 
 extern char **environ;             // defined by libc
@@ -62,6 +131,249 @@ static char prompt[] = "tsh> ";    // command line prompt (DO NOT CHANGE)
 static bool verbose = false;       // If true, print additional output.
 
 static char **paths = NULL;        // paths list to search through 
+static int *pathfds = NULL;        // O_PATH descriptor of each path or -1
+static bool timing = false;        // If true, report startup times.
+
+/*
+ * Output of a background job that is captured instead of being written
+ * to the shell's stdout.  The shell drains the read end of the job's pipe
+ * into "ring", which keeps the most recent OUTBUFSIZE bytes.  A slot
+ * outlives its job so that the output can still be viewed afterwards.
+ */
+struct Capture {
+	int jid;                // job ID, or 0 if the slot was never used
+	pid_t pid;              // job PID
+	int fd;                 // read end of the job's pipe, or -1 at EOF
+	unsigned long long total;	// bytes received so far
+	char ring[OUTBUFSIZE];  // byte i of the output is ring[i % OUTBUFSIZE]
+};
+static struct Capture captures[MAXJOBS];
+
+/*
+ * A coprocess: a background job whose stdin and stdout are both the other
+ * end of a socket pair held by the shell.  A slot outlives its job until
+ * "read" reaches the end of the output, so that a last reply is not lost.
+ */
+struct Coproc {
+	char name[32];          // name given to coproc, or "" if unused
+	pid_t pid;              // job PID
+	int fd;                 // shell's end of the socket pair
+};
+static struct Coproc coprocs[MAXJOBS];
+
+// Buffered reader for the shell's input: stdin, a script, or a sourced file.
+struct Input {
+	int fd;                 // descriptor commands are read from
+	size_t pos;             // index of the next unread byte
+	size_t len;             // number of valid bytes in buf
+	bool eof;               // true once read() has returned 0
+	char buf[INBUFSIZE];
+};
+static struct Input stdinput = { .fd = STDIN_FILENO };
+static struct Input *input = &stdinput;	// where commands are read from
+
+/*
+ * If true, stdout is flushed after every command.  Otherwise output is only
+ * flushed before the shell blocks or forks, which coalesces the output of
+ * many commands into one write.
+ */
+static bool flush_each = true;
+
+/*
+ * A pre-forked helper process.  It already runs in its own process group
+ * and waits on "sock" for a PoolMsg carrying the command to run and, as
+ * SCM_RIGHTS, the descriptors to use as its stdin, stdout, and stderr.
+ * Then it execs immediately.  Helpers inherit the shell's environment,
+ * which the shell never changes, so it is not sent.
+ */
+struct Helper {
+	pid_t pid;              // helper PID
+	int sock;               // shell's end of the control socket
+};
+static struct Helper pool[POOLSIZE];
+static int npool = 0;              // number of idle helpers in pool
+
+// The command a helper receives.
+struct PoolMsg {
+	int dir;                // directory index from resolve()
+	int argc;               // number of strings in args
+	char args[2 * MAXLINE + MAXSUBST]; // NUL-terminated arguments
+};
+
+// Resource limits from the "limit" prefix of a command; -1 means none.
+struct Limits {
+	long long mem;          // memory.max, in bytes
+	long long cpu;          // cpu.max quota per CPUPERIOD, in usec
+	long long pids;         // pids.max
+	long long rlim[NRLIMITS]; // rlimits, indexed like rlimits[]
+};
+
+// The rlimits, by the names that ulimit, limit, and prlimit take.
+static const struct {
+	const char *name;
+	int resource;
+	bool size;              // takes a K, M, G, or T suffix
+} rlimits[NRLIMITS] = {
+	[RL_AS] = { "as", RLIMIT_AS, true },
+	[RL_CPU] = { "cputime", RLIMIT_CPU, false },
+	[RL_NOFILE] = { "nofile", RLIMIT_NOFILE, false },
+	[RL_NPROC] = { "nproc", RLIMIT_NPROC, false },
+	[RL_CORE] = { "core", RLIMIT_CORE, true },
+};
+
+// The limits every job gets unless it overrides them, set with ulimit.
+static struct Limits deflimits = { -1, -1, -1, { -1, -1, -1, -1, -1 } };
+
+/*
+ * The cgroup v2 directory under which jobs with limits get cgroups of
+ * their own: -2 until it is looked up, and -1 if there is none.
+ */
+static int cgroot = -2;
+
+// Shell options that can be changed with "set -o" and "set +o".
+static bool opt_capture = false;   // capture background job output
+static bool opt_pool = false;      // run commands in pre-forked helpers
+static bool opt_notify = true;     // report job status changes at once
+static bool opt_statsdump = false; // print the stats on SIGUSR1
+static int ncaptured = 0;          // captures whose pipe is still open
+static const struct {
+	const char *name;
+	bool *flag;
+} options[] = {
+	{ "capture", &opt_capture },
+	{ "notify", &opt_notify },
+	{ "pool", &opt_pool },
+	{ "statsdump", &opt_statsdump },
+	{ NULL, NULL }
+};
+
+/*
+ * Job status changes that sigchld_handler() reports, held back until the
+ * next prompt unless the notify option is on.  Either way they go out in
+ * one write.
+ */
+static char notes[NOTESIZE];
+static volatile size_t nnotes = 0;
+
+/*
+ * Job status changes of --serve clients' jobs, which sigchld_handler()
+ * adds here and serve_notes() queues for the clients.  Each is the
+ * client's index in two bytes, the length in one, and the line.
+ */
+static char clientnotes[NOTESIZE];
+static volatile size_t nclientnotes = 0;
+
+/*
+ * The --record file, or -1.  Each event is one line, "<usec> <type> ...",
+ * where usec counts from the shell's start and the types are:
+ *   L <line>            an input line, with \\, \n, and other control
+ *                       bytes escaped (C for the line given with -c)
+ *   P                   the shell is ready for the next line
+ *   S <signal>          the shell received INT, TSTP, QUIT, or CHLD
+ *   J <jid> <pid> <how> a job started (fg or bg and its command line),
+ *                       was continued (fg or bg), stopped, terminated,
+ *                       or exited
+ * tshreplay drives the shell with a recording's input and signals and
+ * compares the timelines.
+ */
+static int recordfd = -1;
+static long long recordstart;
+
+/*
+ * Counters and latency histograms for the stats builtin.  An event costs
+ * an increment, and a histogram sample also a clock read on a path that
+ * already forks or sleeps; nothing is formatted until stats asks.  Bucket
+ * 0 counts samples under 1 us and bucket i > 0 those from 2^(i-1) us up
+ * to 2^i us, the last one taking everything longer.
+ */
+#define NBUCKETS 32
+
+struct Histogram {
+	unsigned long count;
+	unsigned long long sum;         // in microseconds
+	unsigned long bucket[NBUCKETS];
+};
+
+static volatile struct Stats {
+	unsigned long spawned;          // jobs added to the table
+	unsigned long execfail;         // commands not found or not executable
+	unsigned long reaped;           // children reaped after exiting
+	unsigned long toomany;          // jobs rejected with a full table
+	unsigned long highwater;        // most jobs in the table at once
+	unsigned long forwarded[NSIG];  // signals sent to jobs, by number
+	struct Histogram spawn;         // fork (or pool hand-off) to added job
+	struct Histogram fgjob;         // foreground job start to finish
+	struct Histogram waitfg;        // time waitfg() spends suspended
+} stats;
+
+static int laststatus = 0;         // exit status of the last command ($?)
+static bool oneshot = false;       // running the line given with -c
+static bool lastcommand = false;   // evaluating the line's last command
+
+/*
+ * Set by sigchld_handler() to the exit status of the foreground job when it
+ * terminates or stops.
+ */
+static volatile sig_atomic_t fg_status = 0;
+
+/*
+ * Set by sigint_handler() when ctrl-c arrives with no foreground job, so
+ * that long-running builtins such as jstat can be interrupted.
+ */
+static volatile sig_atomic_t sigint_pending = 0;
+
+// A client of "tsh --serve".
+struct Client {
+	int sock;               // its connection, or -1 if the slot is free
+	int fd[3];              // its stdin, stdout, and stderr, or -1
+	char in[SRV_MAXFRAME];  // bytes received but not yet handled
+	size_t inlen;           // number of those bytes
+	char line[MAXLINE];     // the command line being evaluated
+	size_t pos;             // where the evaluation of line resumes
+	int op;                 // the operator before pos
+	int laststatus;         // the client's $?
+	pid_t waiting;          // the job the line waits for, -1 for all of
+	                        // the client's jobs, or 0 if it does not wait
+	bool waitfg;            // waiting for a foreground job, not "wait"
+	bool held;              // has a line held back until a job slot frees
+	bool syncing;           // waits for SRV_SYNC before going on
+	bool unsynced;          // has had SRV_OUT since the last SRV_SYNC
+	bool quit;              // ran quit
+	bool broken;            // stopped reading, or its connection failed
+	char *out;              // frames queued for the socket, or NULL
+	size_t outlen;          // number of those bytes
+	size_t outsize;         // bytes allocated for them
+};
+
+static struct Client *clients = NULL; // MAXCLIENTS of them with --serve
+static int nclients = 0;           // slots of clients in use, or free below
+static struct Client *current = NULL; // the client whose line is running
+
+// The server's own stdin, stdout, and stderr, while a client's are in use.
+static int serverfd[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+/*
+ * The server's own stdout stream, and the one that stands in for it while
+ * a client's line runs, which queues what is written for the client.
+ */
+static FILE *serverout = NULL;
+static FILE *clientout = NULL;
+static pid_t serverpid = 0;        // the server, rather than its children
+
+/*
+ * The pids and exit statuses of clients' foreground jobs that terminated or
+ * stopped, recorded by sigchld_handler() for the server to pick up.
+ */
+static volatile struct {
+	pid_t pid;
+	int status;
+} fgdone[MAXJOBS];
+
+// The descriptor that sio_puts() writes to.
+static volatile int sio_fd = STDOUT_FILENO;
+
+// The --serve client that note_job() reports to, or -1.
+static volatile int note_client = -1;
 
 
 /*
@@ -107,21 +419,59 @@ static const char *const signame[NSIG] = {
 
 // You must implement the following functions:
 
-static bool	builtin_cmd(char **argv);
-static void	do_bgfg(char **argv);
+static const struct Builtin *	builtin_cmd(const char *name);
+static int	run_builtin(const struct Builtin *builtin, char **argv);
+static int	do_bgfg(char **argv);
+static int	do_coproc(char **argv);
+static int	do_exec(char **argv);
+static int	do_help(char **argv);
+static int	do_jobs(char **argv);
+static int	do_jstat(char **argv);
+static int	do_kill(char **argv);
+static int	do_notify(char **argv);
+static int	do_output(char **argv);
+static int	do_prlimit(char **argv);
+static int	do_quit(char **argv);
+static int	do_read(char **argv);
+static int	do_set(char **argv);
+static int	do_source(char **argv);
+static int	do_stats(char **argv);
+static int	do_ulimit(char **argv);
+static int	do_wait(char **argv);
+static int	do_write(char **argv);
 static void	eval(const char *cmdline);
+static bool	eval_from(const char *cmdline, size_t *pos, int *op);
+static int	eval_command(char **argv, bool is_bg, const char *cmdline);
+static int	eval_loop(char **argv, const char *cmdline, size_t len,
+		    size_t *pos, int *term, bool skip);
 static void	initpath(const char *pathstr);
 static void	waitfg(pid_t pid);
 
 static void	sigchld_handler(int signum);
 static void	sigint_handler(int signum);
 static void	sigtstp_handler(int signum);
+static void	sigusr1_handler(int signum);
 
 // We are providing the following functions to you:
 
-static bool	parseline(const char *cmdline, char **argv);
+static tok_expand_fn	expand;
+static bool	substitute(struct Tokens *t, const char *cmd, size_t len);
+static void	subshell(void);
+
+static void	note_job(int jid, pid_t pid, const char *what,
+		    const char *detail);
+static void	flush_notes(void);
+static void	print_notes(void);
+static void	record(char type, int jid, pid_t pid, const char *what,
+		    const char *detail);
+static void	record_line(char type, const char *line);
+static void	hist_add(volatile struct Histogram *h, long long ns);
+static size_t	format_stats(char *buf, size_t size, bool json,
+		    char **names);
+static bool	wanted(char **names, const char *name);
 
 static void	sigquit_handler(int signum);
+static void	sigpipe_handler(int signum);
 
 static bool	addjob(JobP jobs, pid_t pid, int state, const char *cmdline);
 static void	clearjob(JobP job);
@@ -129,8 +479,10 @@ static bool	deletejob(JobP jobs, pid_t pid);
 static pid_t	fgpid(JobP jobs);
 static JobP	getjobjid(JobP jobs, int jid); 
 static JobP	getjobpid(JobP jobs, pid_t pid);
+static JobP	getjobarg(JobP jobs, const char *arg);
 static void	initjobs(JobP jobs);
-static void	listjobs(JobP jobs);
+static void	listjobs(JobP jobs, bool usage);
+static bool	jobsfull(JobP jobs);
 static int	maxjid(JobP jobs); 
 static int	pid2jid(pid_t pid); 
 
@@ -158,7 +510,75 @@ static int 	Sigprocmask(int how, const sigset_t *restrict set,
                     sigset_t *restrict oldset);
 
 /* Helpers */
-static char *	get_path(char *str, int begIdx, int endIdx);
+static int	pathfd(int i);
+static long long	monotonic_ns(void);
+static bool	resolve(const char *cmd, int *dir);
+static void	exec_command(char **argv, int dir);
+static void	exec_inplace(char **argv, int dir);
+static void	pool_refill(void);
+static pid_t	pool_spawn(char **argv, int dir, int outfd);
+static void	helper_main(int sock);
+static void	jstat_scan(void);
+static void	jstat_follow(pid_t pid, pid_t pgid);
+static bool	jstat_children(int fd, pid_t pgid);
+static bool	jstat_members(struct Members members[MAXJOBS]);
+static void	jstat_forget(void);
+static bool	jstat_sample(JobP job, const struct Members *members,
+		    long long now, char *line, size_t size);
+static bool	readcmd(char *cmdline, size_t size);
+static bool	poll_events(int fd, const sigset_t *sigmask);
+static void	drain_capture(struct Capture *cap);
+static struct Capture *	newcapture(void);
+static struct Capture *	getcapture(const char *arg);
+static struct Coproc *	getcoproc(const char *name);
+static void	print_capture(struct Capture *cap, unsigned long long from);
+static int	setoption(const char *name, bool value);
+static bool	loop_slot(int max);
+static size_t	varref(const char *w, const char *name,
+		    const struct Tokens *t);
+static void	jointext(char **words, bool is_bg, char *text);
+static void	setdumpsignal(bool on);
+static int	parsesig(const char *arg);
+static pid_t	parsepid(const char *arg);
+static char **	parselimits(char **argv, struct Limits *lim);
+static bool	parsesize(const char *str, long long *bytes);
+static int	cgroup_root(void);
+static int	cgroup_create(const struct Limits *lim, char *name,
+		    size_t size);
+static bool	cgroup_write(int cgfd, const char *file, long long value,
+		    const char *suffix);
+static long long	cgroup_read(int cgfd, const char *file,
+		    const char *key);
+static pid_t	clone_into(int cgfd);
+static bool	parserlimit(const char *arg, long long *rlim);
+static void	apply_rlimits(const struct Limits *lim);
+static void	print_rlimit(const char *name, rlim_t value);
+static void	print_usage(JobP job);
+static bool	running(pid_t pid, int client);
+static void	serve(const char *path);
+static void	serve_accept(int lsock);
+static void	serve_drop(struct Client *c);
+static void	serve_eval(struct Client *c);
+static void	serve_flush(struct Client *c);
+static void	serve_frames(struct Client *c);
+static void	serve_input(struct Client *c);
+static void	serve_notes(void);
+static void	serve_queue(struct Client *c, int type, const void *data,
+		    size_t len);
+static void	serve_signal(struct Client *c, int sig);
+static bool	serve_sync(struct Client *c);
+static bool	serve_waited(struct Client *c);
+static ssize_t	serve_write(void *cookie, const char *buf, size_t size);
+
+// The builtin commands, in the order of builtins.def.
+static const struct Builtin builtins[] = {
+#define BUILTIN(name, handler, flags, usage, help) \
+	{ #name, handler, flags, usage, help },
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#include "builtin_table.h"
 
 /*
 * Requires: 
@@ -265,474 +685,3702 @@ Malloc(size_t size)
 	return (ptr);
 }
 
+
 /*
-* Requires: 
-*   endIdx to be >= begIdx and begIdx to endIdx - 1 are
-*   are valid indexas of str.
-*
-* Effects: 
-*   Produces a pointer to a NUL-terminated string from
-*   begIdx (inclusive) to endIdx (exclusive). 
-*/
-static char *
-get_path(char *str, int begIdx, int endIdx)
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static long long
+monotonic_ns(void)
 {
-	int length = endIdx - begIdx;
-	// Creates the new string to be inserted.
-	char *newStr = Malloc((sizeof(char) * (length + 2)));
-	// Copies the string over.
-	for (int i = 0; i < length; i++) {
-		newStr[i] = str[i + begIdx];
-	}
-	// NUL terminates the string.
-	newStr[length] = '/';
-	newStr[length + 1] = '\0';
-	return newStr;
-}
-
+	struct timespec ts;
 
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
 
 /*
  * Requires:
- *   Nothing. 
+ *   SIGCHLD is blocked.
  *
  * Effects:
- *   Runs a tiny shell program that takes one of four
- *   built in commands and that command's arguments or an 
- *   executable and its arguments. 
+ *   Scans /proc once for the processes in a job's process group other than
+ *   its leader and follows them with jstat_follow().  Only needed when
+ *   jstat starts and after a member with children exits, since those are
+ *   the only times a member may not be the child of another one.
  */
-int
-main(int argc, char **argv) 
+static void
+jstat_scan(void)
 {
-	struct sigaction action;
-	
-	int c;
-	char cmdline[MAXLINE];
-	char *path = NULL;
-	bool emit_prompt = true;	// Emit a prompt by default.
-
-	/*
-	 * Redirect stderr to stdout (so that driver will get all output
-	 * on the pipe connected to stdout).
-	 */
-	if (dup2(1, 2) < 0)
-		unix_error("dup2 error");
+	char buf[1024], path[64], *p;
+	struct dirent *de;
+	DIR *dir;
+	int fd, pid, pgid;
+	ssize_t n;
 
-	// Parse the command line.
-	while ((c = getopt(argc, argv, "hvp")) != -1) {
-		switch (c) {
-		case 'h':             // Print a help message.
-			usage();
-			break;
-		case 'v':             // Emit additional diagnostic info.
-			verbose = true;
-			break;
-		case 'p':             // Don't print a prompt.
-			// This is handy for automatic testing.
-			emit_prompt = false;
-			break;
-		default:
-			usage();
-		}
+	if ((dir = opendir("/proc")) == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if ((pid = atoi(de->d_name)) <= 0)
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+		if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+			continue;
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (n <= 0)
+			continue;
+		buf[n] = '\0';
+		if ((p = strrchr(buf, ')')) != NULL &&
+		    sscanf(p + 2, "%*c %*d %d", &pgid) == 1 &&
+		    getjobpid(jobs, pgid) != NULL)
+			jstat_follow(pid, pgid);
 	}
+	closedir(dir);
+}
 
-	/*
-	 * Install sigint_handler() as the handler for SIGINT (ctrl-c).  SET
-	 * action.sa_mask TO REFLECT THE SYNCHRONIZATION REQUIRED BY YOUR
-	 * IMPLEMENTATION OF sigint_handler().
-	 */
-	action.sa_handler = sigint_handler;
-	action.sa_flags = SA_RESTART;
-	if (sigemptyset(&action.sa_mask) < 0)
-		unix_error("sigemptyset error");
-	Sigaddset(&action.sa_mask, SIGTSTP);
-	Sigaddset(&action.sa_mask, SIGCHLD);
-	if (sigaction(SIGINT, &action, NULL) < 0)
-		unix_error("sigaction error");
-
-	/*
-	 * Install sigtstp_handler() as the handler for SIGTSTP (ctrl-z).  SET
-	 * action.sa_mask TO REFLECT THE SYNCHRONIZATION REQUIRED BY YOUR
-	 * IMPLEMENTATION OF sigtstp_handler().
-	 */
-	action.sa_handler = sigtstp_handler;
-	action.sa_flags = SA_RESTART;
-	if (sigemptyset(&action.sa_mask) < 0)
-		unix_error("sigemptyset error");
-	Sigaddset(&action.sa_mask, SIGINT);
-	Sigaddset(&action.sa_mask, SIGCHLD);
-	if (sigaction(SIGTSTP, &action, NULL) < 0)
-		unix_error("sigaction error");
-
-	/*
-	 * Install sigchld_handler() as the handler for SIGCHLD (terminated or
-	 * stopped child).  SET action.sa_mask TO REFLECT THE SYNCHRONIZATION
-	 * REQUIRED BY YOUR IMPLEMENTATION OF sigchld_handler().
-	 */
-	action.sa_handler = sigchld_handler;
-	action.sa_flags = SA_RESTART;
-	if (sigemptyset(&action.sa_mask) < 0)
-		unix_error("sigemptyset error");
-	Sigaddset(&action.sa_mask, SIGTSTP);
-	Sigaddset(&action.sa_mask, SIGINT);
-	if (sigaction(SIGCHLD, &action, NULL) < 0)
-		unix_error("sigaction error");
+/*
+ * Requires:
+ *   SIGCHLD is blocked, and "pgid" is the PID of a job's leader.
+ *
+ * Effects:
+ *   Starts following process "pid" as a member of the job, by opening its
+ *   stat and children files, unless it is a leader, is already followed,
+ *   or MAXMEMBERS processes are.  jstat_members() drops it again if it is
+ *   not in the job's process group.
+ */
+static void
+jstat_follow(pid_t pid, pid_t pgid)
+{
+	struct Member *m = NULL;
+	char path[64];
+	int i;
 
-	/*
-	 * Install sigquit_handler() as the handler for SIGQUIT.  This handler
-	 * provides a clean way for the test harness to terminate the shell.
-	 * Preemption of the processor by the other signal handlers during
-	 * sigquit_handler() does no harm, so action.sa_mask is set to empty.
-	 */
-	action.sa_handler = sigquit_handler;
-	action.sa_flags = SA_RESTART;
-	if (sigemptyset(&action.sa_mask) < 0)
-		unix_error("sigemptyset error");
-	if (sigaction(SIGQUIT, &action, NULL) < 0)
-		unix_error("sigaction error");
+	if (getjobpid(jobs, pid) != NULL)
+		return;
+	for (i = 0; i < MAXMEMBERS; i++) {
+		if (followed[i].pid == pid)
+			return;
+		if (followed[i].pid == 0 && m == NULL)
+			m = &followed[i];
+	}
+	if (m == NULL)
+		return;
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	if ((m->statfd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+	snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid,
+	    (int)pid);
+	m->childfd = open(path, O_RDONLY | O_CLOEXEC);
+	m->pid = pid;
+	m->pgid = pgid;
+	m->parent = false;
+}
 
-	// Initialize the search path.
-	path = getenv("PATH");
-	initpath(path);
+/*
+ * Requires:
+ *   SIGCHLD is blocked, and "fd" is a process's children file or -1.
+ *
+ * Effects:
+ *   Follows each child listed in "fd" as a member of the job whose leader
+ *   is "pgid".  Returns true if the process has children.  Children of the
+ *   process's other threads are only found by jstat_scan().
+ */
+static bool
+jstat_children(int fd, pid_t pgid)
+{
+	char buf[4096], *p, *end;
+	long pid;
+	ssize_t n;
 
-	// Initialize the jobs list.
-	initjobs(jobs);
+	if (fd < 0 || (n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return (false);
+	buf[n] = '\0';
+	for (p = buf; (pid = strtol(p, &end, 10)) > 0; p = end)
+		jstat_follow((pid_t)pid, pgid);
+	return (true);
+}
 
-	// Execute the shell's read/eval loop.
-	while (true) {
+/*
+ * Requires:
+ *   SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Adds up, for each job, the processes in its process group other than
+ *   its leader into the job's entry of "members".  Follows the new
+ *   children of the leaders and members, drops the members that exited,
+ *   left the group, or whose job is gone, and rereads the rest through
+ *   their open descriptors, so that no file is opened unless the members
+ *   change.  Returns true if a member that has had children exited, which
+ *   calls for a jstat_scan() to find them.
+ */
+static bool
+jstat_members(struct Members members[MAXJOBS])
+{
+	char buf[1024], path[64], *p;
+	unsigned long long utime, stime;
+	long threads, pages;
+	bool rescan = false;
+	struct Member *m;
+	JobP job;
+	int pgid, i;
+	ssize_t n;
 
-		// Read the command line.
-		if (emit_prompt) {
-			printf("%s", prompt);
-			fflush(stdout);
+	memset(members, 0, MAXJOBS * sizeof(*members));
+	for (i = 0; i < MAXJOBS; i++) {
+		job = &jobs[i];
+		if (job->pid == 0)
+			continue;
+		if (job->childfd < 0) {
+			snprintf(path, sizeof(path), "/proc/%d/task/%d/children",
+			    (int)job->pid, (int)job->pid);
+			job->childfd = open(path, O_RDONLY | O_CLOEXEC);
 		}
-		if (fgets(cmdline, MAXLINE, stdin) == NULL && ferror(stdin))
-			app_error("fgets error");
-		if (feof(stdin)) // End of file (ctrl-d)
-			exit(0);
-
-		// Evaluate the command line.
-		eval(cmdline);
-		fflush(stdout);
+		jstat_children(job->childfd, job->pid);
 	}
+	// A member that has had children may leave orphans when it exits.
+	for (m = followed; m < &followed[MAXMEMBERS]; m++)
+		if (m->pid != 0 && jstat_children(m->childfd, m->pgid))
+			m->parent = true;
 
-	// Control never reaches here.
-	assert(false);
+	for (m = followed; m < &followed[MAXMEMBERS]; m++) {
+		if (m->pid == 0)
+			continue;
+		job = getjobpid(jobs, m->pgid);
+		n = job != NULL ? pread(m->statfd, buf, sizeof(buf) - 1, 0) : 0;
+		if (n > 0) {
+			buf[n] = '\0';
+			if ((p = strrchr(buf, ')')) == NULL || sscanf(p + 2,
+			    "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu "
+			    "%llu %*d %*d %*d %*d %ld %*d %*u %*u %ld",
+			    &pgid, &utime, &stime, &threads, &pages) != 5 ||
+			    pgid != m->pgid)
+				n = 0;
+		}
+		if (n <= 0) {
+			rescan |= job != NULL && m->parent;
+			close(m->statfd);
+			if (m->childfd >= 0)
+				close(m->childfd);
+			m->pid = 0;
+			continue;
+		}
+		i = job - jobs;
+		members[i].procs++;
+		members[i].threads += threads;
+		members[i].ticks += utime + stime;
+		members[i].pages += pages;
+	}
+	return (rescan);
 }
-  
-/* 
- * eval - Evaluate the command line that the user has just typed in.
- * 
- * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately.  Otherwise, fork a child process and
- * run the job in the context of the child.  If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.  
- *
+
+/*
  * Requires:
- *   A properly terminated commandline string. 
+ *   Nothing.
  *
  * Effects:
- *   Evaluates the commandine passed; immediately executes built-in 
- *   commands. Otherwise, runs its executable in child process (either
- *   in the foreground or background). Returns to main() after. 
- *   
+ *   Stops following every member, closing their descriptors.
  */
 static void
-eval(const char *cmdline) 
+jstat_forget(void)
 {
-	//Holds the command line arguments. 
-	char *argv[MAXARGS];
-	//Parses the commandline and updates argv with parsed. 
-	bool is_bg = parseline(cmdline, argv);
-	
-	pid_t pid; 
+	struct Member *m;
 
-	//Case that handles just pressing enter. 
-	if (argv[0] == NULL) {
-		return;
+	for (m = followed; m < &followed[MAXMEMBERS]; m++) {
+		if (m->pid == 0)
+			continue;
+		close(m->statfd);
+		if (m->childfd >= 0)
+			close(m->childfd);
+		m->pid = 0;
 	}
+}
+
+/*
+ * Requires:
+ *   "job" is an allocated job, "members" is what jstat_members() found in
+ *   its process group, SIGCHLD is blocked, and "now" is the current
+ *   monotonic time from monotonic_ns().
+ *
+ * Effects:
+ *   Samples /proc/<pid>/stat and /proc/<pid>/statm for the job's leader,
+ *   adds "members" to it, and formats one jstat row into "line".  The
+ *   leader's descriptors are opened on the first sample and reread with
+ *   pread() afterwards.  CPU usage is measured since the previous sample,
+ *   or since the job started on the first one, and leaves out members
+ *   that exited in between.  Returns false if the job's leader could not
+ *   be read.
+ */
+static bool
+jstat_sample(JobP job, const struct Members *members, long long now,
+    char *line, size_t size)
+{
+	static long hz = 0, pagesize = 0;
+	char buf[1024], path[64];
+	char state, *p;
+	int pgid, threads;
+	unsigned long long utime, stime, start, ticks;
+	long pages, resident = 0;
+	double elapsed, cpu;
+	ssize_t n;
 
-	bool is_builtin = builtin_cmd(argv);
+	if (hz == 0) {
+		hz = sysconf(_SC_CLK_TCK);
+		pagesize = sysconf(_SC_PAGESIZE);
+	}
+	if (job->statfd < 0) {
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)job->pid);
+		if ((job->statfd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+			return (false);
+		snprintf(path, sizeof(path), "/proc/%d/statm", (int)job->pid);
+		job->statmfd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	if ((n = pread(job->statfd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return (false);
+	buf[n] = '\0';
+	// The command name may contain spaces, so skips past its last ')'.
+	if ((p = strrchr(buf, ')')) == NULL || sscanf(p + 2,
+	    "%c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+	    "%*d %*d %*d %*d %d %*d %llu",
+	    &state, &pgid, &utime, &stime, &threads, &start) != 6)
+		return (false);
+	if (job->statmfd >= 0 &&
+	    (n = pread(job->statmfd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[n] = '\0';
+		if (sscanf(buf, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+	}
 
-	if (!is_builtin) {//Child runs the job. 
+	ticks = utime + stime + members->ticks;
+	threads += members->threads;
+	resident += members->pages;
+	if (job->sampled == 0) {
+		// Measures the first sample from the job's start time.
+		struct timespec boot;
+		clock_gettime(CLOCK_BOOTTIME, &boot);
+		elapsed = boot.tv_sec + boot.tv_nsec / 1e9 -
+		    (double)start / hz;
+		cpu = elapsed > 0 ? ticks / (double)hz / elapsed : 0;
+	} else {
+		elapsed = (now - job->sampled) / 1e9;
+		cpu = elapsed > 0 && ticks > job->cputicks ?
+		    (ticks - job->cputicks) / (double)hz / elapsed : 0;
+	}
+	job->cputicks = ticks;
+	job->sampled = now;
 
-		//Blocks child to avoid race condition. 
-		sigset_t mask, prevmask;
-		Sigemptyset(&mask);
-		Sigemptyset(&prevmask);
-		Sigaddset(&mask, SIGCHLD);
-		Sigprocmask(SIG_BLOCK, &mask, &prevmask);
-		//Child process runs the job. 
-		if ((pid = Fork()) == 0) {
-			setpgid(0,0);
-			//Unblocks the child. 
-			Sigprocmask(SIG_SETMASK, &prevmask, NULL);
-			//If file is a directory, then run execv.
-			if (strchr(argv[0], '/') != NULL || paths == NULL) {
-				execve(argv[0], argv, environ);
-			} else { //File is not a directory, so searchs the paths
-				for (int i = 0; paths[i] != NULL; i++) {
-					// Tests case that represents current directory.
-					if (strcmp(paths[i], "/") == 0) { 
-						execve(argv[0], argv, environ);
-					} else { 
-						//Concatenates the two strings. 
-						int length = strlen(paths[i]) + strlen(argv[0]);
-						char copy[length+1];
-						strcpy((char *)copy, paths[i]);
-						//Checks for the pre-concatenated string. 
-						if (verbose) {
-							printf("%s%s %u", "pre-concatentation: ", copy, 
-							    (unsigned int)strlen(paths[i]));
-						}
-						//Concatenates the path and file name. 
-						strcat(&copy[strlen(paths[i])], argv[0]);
-						//Check after concatenation. 
-						if (verbose) {	
-							printf("%s", " attempted path: '");
-							printf("%s", (char *)copy);
-							printf("%s", "'\n");
-						}
-						//Runs execve.
-						execve((char *)copy, argv, environ);
-					}
+	snprintf(line, size, "[%d] %8d %8d %c %5d %4d %6.1f %10ld %s",
+	    job->jid, (int)job->pid, pgid, state, 1 + members->procs,
+	    threads, cpu * 100,
+	    resident * (pagesize / 1024), job->cmdline);
+	return (true);
+}
 
-				}
-			}
-			//Execve must not have run if reached this point. 
-			printf("%s: Command not found.\n", argv[0]);
-			exit(0);
-		}
-		
-		int bg_fg = is_bg ? 2 : 1;
-		addjob(jobs, pid, bg_fg, cmdline);
-		//Unblocks the child. 
-		Sigprocmask(SIG_UNBLOCK, &mask, &prevmask);
-		//Parent waits for fg job.
-		if (!is_bg) {
-			waitfg(pid);
-		} else { //Prints job information when running as background.
-			JobP job = getjobpid(jobs, pid);
-			printf("[%u] (%u) %s", job->jid, job->pid, job->cmdline);
+/*
+ * Requires:
+ *   "cmd" is a properly terminated string.
+ *
+ * Effects:
+ *   Finds the executable file that the command "cmd" names, searching the
+ *   directories in 'paths' if "cmd" contains no '/'.  Sets "dir" to the
+ *   index of the directory in 'paths', or to -1 if "cmd" is used as is, and
+ *   returns true.  Returns false if there is no such executable.  Uses
+ *   faccessat() against the descriptors in 'pathfds', so no path strings
+ *   are built.
+ */
+static bool
+resolve(const char *cmd, int *dir)
+{
+	struct stat sb;
+	int i;
+
+	if (paths == NULL && strchr(cmd, '/') == NULL)
+		initpath(getenv("PATH"));
+	if (strchr(cmd, '/') != NULL || paths == NULL) {
+		*dir = -1;
+		return (faccessat(AT_FDCWD, cmd, X_OK, 0) == 0 &&
+		    stat(cmd, &sb) == 0 && S_ISREG(sb.st_mode));
+	}
+	for (i = 0; paths[i] != NULL; i++) {
+		if (pathfd(i) == -1 ||
+		    faccessat(pathfds[i], cmd, X_OK, 0) != 0)
+			continue;
+		// Skips directories, which also pass the X_OK check.
+		if (fstatat(pathfds[i], cmd, &sb, 0) != 0 ||
+		    !S_ISREG(sb.st_mode))
+			continue;
+		if (verbose)
+			printf("resolved '%s' in %s\n", cmd, paths[i]);
+		*dir = i;
+		return (true);
+	}
+	return (false);
+}
+
+/*
+ * Requires:
+ *   "argv" is a command that resolve() found in directory "dir".  This
+ *   is called in a child process.
+ *
+ * Effects:
+ *   Replaces the process with the command.  If that fails, prints why and
+ *   exits with status 126.
+ */
+static void
+exec_command(char **argv, int dir)
+{
+
+	execveat(dir < 0 ? AT_FDCWD : pathfd(dir), argv[0], argv, environ,
+	    0);
+	/*
+	 * A "#!" script cannot be run relative to a close-on-exec
+	 * descriptor, because its interpreter could not open it, so
+	 * retries those with the full path.
+	 */
+	if (errno == ENOENT && dir >= 0 && pathfds[dir] >= 0) {
+		char path[strlen(paths[dir]) + strlen(argv[0]) + 1];
+		strcpy(path, paths[dir]);
+		strcat(path, argv[0]);
+		execve(path, argv, environ);
+	}
+	//Execve must have failed if reached this point. 
+	printf("%s: %s\n", argv[0], strerror(errno));
+	exit(126);
+}
+
+/*
+ * Requires:
+ *   "dir" was set by resolve() for argv[0].
+ *
+ * Effects:
+ *   Replaces the shell with the command in argv, which keeps the shell's
+ *   pid and process group and gets the rlimits set with ulimit, as any
+ *   job would.  Writes the held-back job notifications and the job logs
+ *   that the writer thread has yet to move first, since the shell will
+ *   not reach another prompt.  Prints an error and exits if the command
+ *   cannot be executed.
+ */
+static void
+exec_inplace(char **argv, int dir)
+{
+
+	print_notes();
+	joblog_finish();
+	apply_rlimits(&deflimits);
+	exec_command(argv, dir);
+}
+
+/*
+ * Requires:
+ *   SIGCHLD is not blocked.
+ *
+ * Effects:
+ *   Forks helpers until the pool holds POOLSIZE of them.  Each helper puts
+ *   itself in its own process group and waits in helper_main().
+ */
+static void
+pool_refill(void)
+{
+	int sv[2], i;
+	pid_t pid;
+
+	// Helpers get commands by path index, so they need the same paths.
+	if (paths == NULL && npool < POOLSIZE)
+		initpath(getenv("PATH"));
+	while (npool < POOLSIZE) {
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+		    sv) < 0)
+			unix_error("socketpair error");
+		fflush(stdout);
+		if ((pid = Fork()) == 0) {
+			setpgid(0, 0);
+			// Keeps only its own end of the control sockets.
+			for (i = 0; i < npool; i++)
+				close(pool[i].sock);
+			close(sv[0]);
+			helper_main(sv[1]);
+		}
+		close(sv[1]);
+		pool[npool].pid = pid;
+		pool[npool++].sock = sv[0];
+	}
+}
+
+/*
+ * Requires:
+ *   "argv" is a command that resolve() found in directory "dir".  SIGCHLD
+ *   is blocked.  "outfd" is the descriptor for the command's stdout and
+ *   stderr, or -1 to use the shell's.
+ *
+ * Effects:
+ *   Sends the command to an idle helper and returns the helper's PID,
+ *   which is now the command's PID.  Returns -1 if the pool is empty, in
+ *   which case the caller must fork.  Helpers that have died are dropped.
+ */
+static pid_t
+pool_spawn(char **argv, int dir, int outfd)
+{
+	static struct PoolMsg msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char *out = msg.args;
+	int i;
+
+	if (outfd >= 0)
+		fds[1] = fds[2] = outfd;
+	msg.dir = dir;
+	for (i = 0; argv[i] != NULL; i++)
+		out = stpcpy(out, argv[i]) + 1;
+	msg.argc = i;
+
+	iov.iov_base = &msg;
+	iov.iov_len = out - (char *)&msg;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	while (npool > 0) {
+		struct Helper helper = pool[--npool];
+		ssize_t n = sendmsg(helper.sock, &mh, MSG_NOSIGNAL);
+		close(helper.sock);
+		if (n >= 0)
+			return (helper.pid);
+	}
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   This is called in a newly forked helper, and "sock" is its end of the
+ *   control socket.
+ *
+ * Effects:
+ *   Waits for a command from the shell, installs the descriptors that came
+ *   with it as stdin, stdout, and stderr, and execs it.  Exits if the shell
+ *   closes the socket instead.
+ */
+static void
+helper_main(int sock)
+{
+	static struct PoolMsg msg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	char *argv[MAXARGS], *arg;
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int fds[3], i;
+
+	// The shell's handlers must not run here; exec resets them anyway.
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(msg);
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) <= 0 ||
+	    (cmsg = CMSG_FIRSTHDR(&mh)) == NULL ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		_exit(0);
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	for (i = 0; i < 3; i++)
+		dup2(fds[i], i);
+
+	arg = msg.args;
+	for (i = 0; i < msg.argc && i < MAXARGS - 1; i++) {
+		argv[i] = arg;
+		arg += strlen(arg) + 1;
+	}
+	argv[i] = NULL;
+	exec_command(argv, msg.dir);
+}
+
+/*
+ * Requires:
+ *   "cmdline" has room for "size" characters, and "size" is less than
+ *   INBUFSIZE.
+ *
+ * Effects:
+ *   Reads the next line of the current input into "cmdline", splitting
+ *   lines that are too long like fgets() does.  Input is read INBUFSIZE
+ *   bytes at a time, and stdout is flushed before each read.
+ *   While waiting for input, drains the output of captured jobs.  Returns
+ *   false at end of file.
+ */
+static bool
+readcmd(char *cmdline, size_t size)
+{
+	char *nl;
+	size_t n;
+	ssize_t nread;
+
+	while (true) {
+		nl = memchr(&input->buf[input->pos], '\n', input->len - input->pos);
+		n = nl != NULL ? (size_t)(nl - &input->buf[input->pos]) + 1 :
+		    input->len - input->pos;
+		if (nl != NULL || n >= size - 1) {
+			if (n > size - 1)
+				n = size - 1;
+			memcpy(cmdline, &input->buf[input->pos], n);
+			cmdline[n] = '\0';
+			input->pos += n;
+			return (true);
+		}
+		// An unterminated last line is discarded, as with fgets().
+		if (input->eof)
+			return (false);
+
+		// Moves the partial line to the front and refills the buffer.
+		memmove(input->buf, &input->buf[input->pos], n);
+		input->pos = 0;
+		input->len = n;
+		// Makes all output visible before possibly blocking.
+		fflush(stdout);
+		// Uses idle time, if input is not already waiting, to
+		// replace helpers that were used.
+		if (opt_pool && npool < POOLSIZE) {
+			struct pollfd pfd = { .fd = input->fd, .events = POLLIN };
+			if (poll(&pfd, 1, 0) == 0)
+				pool_refill();
+		}
+		if (ncaptured > 0 && !poll_events(input->fd, NULL))
+			continue;
+		nread = read(input->fd, &input->buf[input->len],
+		    sizeof(input->buf) - input->len);
+		if (nread < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("read error");
+		}
+		if (nread == 0)
+			input->eof = true;
+		input->len += nread;
+	}
+}
+
+/*
+ * Requires:
+ *   "sigmask" is NULL or the signal mask to install while waiting, as for
+ *   ppoll().
+ *
+ * Effects:
+ *   Waits until "fd" is readable, a captured job produces output, or a
+ *   signal arrives.  Drains the pipes of captured jobs that are readable.
+ *   Returns true if "fd" is readable and false otherwise.  Pass -1 as "fd"
+ *   to wait only for captured output and signals.
+ */
+static bool
+poll_events(int fd, const sigset_t *sigmask)
+{
+	struct pollfd fds[MAXJOBS + 1];
+	struct Capture *owner[MAXJOBS + 1];
+	int i, nfds = 0;
+	bool ready = false;
+
+	if (fd >= 0) {
+		fds[nfds].fd = fd;
+		fds[nfds].events = POLLIN;
+		owner[nfds++] = NULL;
+	}
+	for (i = 0; i < MAXJOBS; i++) {
+		if (captures[i].fd >= 0 && captures[i].jid != 0) {
+			fds[nfds].fd = captures[i].fd;
+			fds[nfds].events = POLLIN;
+			owner[nfds++] = &captures[i];
+		}
+	}
+	if (ppoll(fds, nfds, NULL, sigmask) < 0) {
+		if (errno == EINTR)
+			return (false);
+		unix_error("ppoll error");
+	}
+	for (i = 0; i < nfds; i++) {
+		if (fds[i].revents == 0)
+			continue;
+		if (owner[i] == NULL)
+			ready = true;
+		else
+			drain_capture(owner[i]);
+	}
+	return (ready);
+}
+
+/*
+ * Requires:
+ *   "cap" is a capture whose pipe is open.
+ *
+ * Effects:
+ *   Reads everything available from the capture's pipe into its ring
+ *   buffer, overwriting the oldest output.  If the job is now in the
+ *   foreground, also copies its output to stdout.  Closes the pipe at end
+ *   of file.
+ */
+static void
+drain_capture(struct Capture *cap)
+{
+	char buf[OUTBUFSIZE];
+	size_t off, first;
+	ssize_t n;
+
+	while ((n = read(cap->fd, buf, sizeof(buf))) > 0) {
+		if (cap->pid == fgpid(jobs)) {
+			fflush(stdout);
+			if (write(STDOUT_FILENO, buf, n) < 0)
+				unix_error("write error");
+		}
+		off = cap->total % OUTBUFSIZE;
+		first = OUTBUFSIZE - off < (size_t)n ? OUTBUFSIZE - off :
+		    (size_t)n;
+		memcpy(&cap->ring[off], buf, first);
+		memcpy(cap->ring, &buf[first], n - first);
+		cap->total += n;
+	}
+	if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+		close(cap->fd);
+		cap->fd = -1;
+		ncaptured--;
+	}
+}
+
+/*
+ * Requires:
+ *   Fewer than MAXJOBS jobs are still using a capture.
+ *
+ * Effects:
+ *   Returns an unused capture, preferring one that was never used, then
+ *   one whose pipe is closed.  Otherwise closes the pipe of a capture whose
+ *   job has already terminated and returns that one.
+ */
+static struct Capture *
+newcapture(void)
+{
+	struct Capture *cap = NULL;
+	int i;
+
+	for (i = 0; i < MAXJOBS && cap == NULL; i++)
+		if (captures[i].jid == 0)
+			cap = &captures[i];
+	for (i = 0; i < MAXJOBS && cap == NULL; i++)
+		if (captures[i].fd < 0)
+			cap = &captures[i];
+	for (i = 0; i < MAXJOBS && cap == NULL; i++) {
+		if (getjobpid(jobs, captures[i].pid) == NULL) {
+			cap = &captures[i];
+			close(cap->fd);
+			cap->fd = -1;
+			ncaptured--;
+		}
+	}
+	assert(cap != NULL);
+	return (cap);
+}
+
+/*
+ * Requires:
+ *   "arg" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the most recent capture of the job named by "arg", which is
+ *   either a PID or a %jobid, or NULL if there is none.
+ */
+static struct Capture *
+getcapture(const char *arg)
+{
+	struct Capture *cap = NULL;
+	int i, jid = 0;
+	pid_t pid = 0;
+
+	if (arg[0] == '%')
+		jid = atoi(&arg[1]);
+	else
+		pid = atoi(arg);
+	if (jid == 0 && pid == 0)
+		return (NULL);
+	// A %jobid may have been reused, so the open or newest capture wins.
+	for (i = 0; i < MAXJOBS; i++) {
+		if (captures[i].jid == 0 || (jid != 0 &&
+		    captures[i].jid != jid) || (pid != 0 &&
+		    captures[i].pid != pid))
+			continue;
+		if (cap == NULL || captures[i].fd >= 0 ||
+		    (cap->fd < 0 && captures[i].pid > cap->pid))
+			cap = &captures[i];
+	}
+	return (cap);
+}
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the coprocess called "name", or NULL if there is none.
+ */
+static struct Coproc *
+getcoproc(const char *name)
+{
+	int i;
+
+	for (i = 0; i < MAXJOBS; i++)
+		if (coprocs[i].name[0] != '\0' &&
+		    strcmp(coprocs[i].name, name) == 0)
+			return (&coprocs[i]);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "from" is no greater than the number of bytes the capture received.
+ *
+ * Effects:
+ *   Prints the capture's output starting at byte "from".  If some of it
+ *   was already overwritten, first prints how many bytes were dropped.
+ */
+static void
+print_capture(struct Capture *cap, unsigned long long from)
+{
+	unsigned long long oldest = cap->total > OUTBUFSIZE ?
+	    cap->total - OUTBUFSIZE : 0;
+	size_t off, first, n;
+
+	if (from < oldest) {
+		printf("[%d] (%d) %llu bytes dropped\n", cap->jid,
+		    (int)cap->pid, oldest - from);
+		from = oldest;
+	}
+	n = cap->total - from;
+	off = from % OUTBUFSIZE;
+	first = OUTBUFSIZE - off < n ? OUTBUFSIZE - off : n;
+	fwrite(&cap->ring[off], 1, first, stdout);
+	fwrite(cap->ring, 1, n - first, stdout);
+	fflush(stdout);
+}
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Sets the shell option "name" to "value".  "log=DIR" (only with -o)
+ *   starts logging background jobs to DIR, "logsize=SIZE" sets the size at
+ *   which their files are rotated, and "logkeep=N" how many rotated files
+ *   of each job are kept.  Returns 0 once the option is
+ *   set, 1 after printing why if its value is bad, and -1 if there is no
+ *   such option.
+ */
+static int
+setoption(const char *name, bool value)
+{
+	long long size;
+	char *end;
+	long keep;
+	int i;
+
+	// The log options take a value: log=DIR (or +o log), logsize=SIZE,
+	// and logkeep=N.
+	if (strncmp(name, "log=", 4) == 0 && value) {
+		if (joblog_setdir(&name[4]))
+			return (0);
+		printf("log: %s: %s\n", &name[4], strerror(errno));
+		return (1);
+	}
+	if (strcmp(name, "log") == 0 && !value) {
+		joblog_setdir(NULL);
+		return (0);
+	}
+	if (strncmp(name, "logsize=", 8) == 0 && value) {
+		if (parsesize(&name[8], &size)) {
+			joblog_setsize(size);
+			return (0);
+		}
+		printf("logsize: %s: Invalid size\n", &name[8]);
+		return (1);
+	}
+	if (strncmp(name, "logkeep=", 8) == 0 && value) {
+		errno = 0;
+		keep = strtol(&name[8], &end, 10);
+		if (end != &name[8] && *end == '\0' && errno == 0 &&
+		    keep >= 0 && keep <= INT_MAX) {
+			joblog_setkeep((int)keep);
+			return (0);
+		}
+		printf("logkeep: %s: Invalid count\n", &name[8]);
+		return (1);
+	}
+	for (i = 0; options[i].name != NULL; i++) {
+		if (strcmp(options[i].name, name) == 0) {
+			*options[i].flag = value;
+			if (options[i].flag == &opt_statsdump)
+				setdumpsignal(value);
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Catches SIGUSR1 with sigusr1_handler(), blocking SIGCHLD and SIGINT
+ *   while it runs, if "on" is true, and restores its default action, which
+ *   terminates the shell, otherwise.
+ */
+static void
+setdumpsignal(bool on)
+{
+	struct sigaction action;
+
+	action.sa_handler = on ? sigusr1_handler : SIG_DFL;
+	action.sa_flags = SA_RESTART;
+	Sigemptyset(&action.sa_mask);
+	Sigaddset(&action.sa_mask, SIGCHLD);
+	Sigaddset(&action.sa_mask, SIGINT);
+	if (sigaction(SIGUSR1, &action, NULL) < 0)
+		unix_error("sigaction error");
+}
+
+/*
+ * Requires:
+ *   "arg" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the number of the signal named (with or without "SIG") or
+ *   numbered by "arg", or -1 if there is no such signal.
+ */
+static int
+parsesig(const char *arg)
+{
+	char *end;
+	long num;
+	int i;
+
+	if (arg[0] >= '0' && arg[0] <= '9') {
+		num = strtol(arg, &end, 10);
+		return (*end == '\0' && num < NSIG ? (int)num : -1);
+	}
+	if (strncmp(arg, "SIG", 3) == 0)
+		arg += 3;
+	for (i = 1; i < NSIG; i++)
+		if (signame[i] != NULL && strcmp(signame[i], arg) == 0)
+			return (i);
+	return (-1);
+}
+
+/*
+ * Requires:
+ *   "arg" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the process ID that "arg" is written as, or 0 if "arg" is not
+ *   a decimal number from 1 to the largest pid_t.
+ */
+static pid_t
+parsepid(const char *arg)
+{
+	char *end;
+	long num;
+
+	if (arg[0] < '0' || arg[0] > '9')
+		return (0);
+	errno = 0;
+	num = strtol(arg, &end, 10);
+	if (*end != '\0' || errno != 0 || num < 1 || num > INT_MAX)
+		return (0);
+	return ((pid_t)num);
+}
+
+/*
+ * Requires:
+ *   "argv" is the NULL-terminated rest of a command after "limit".
+ *
+ * Effects:
+ *   Parses the leading "mem=SIZE", "cpu=CPUS", and "pids=N" arguments,
+ *   and rlimits as taken by parserlimit(), into "lim" and returns the rest
+ *   of "argv", the command to limit.  SIZE is bytes with an optional K, M,
+ *   G, or T suffix, and CPUS is a number of CPUs, such as 1.5.  Prints an
+ *   error and returns NULL if an argument is bad or no command follows.
+ */
+static char **
+parselimits(char **argv, struct Limits *lim)
+{
+	char *end;
+	double cpus;
+
+	for (; *argv != NULL && strchr(*argv, '=') != NULL; argv++) {
+		if (strncmp(*argv, "mem=", 4) == 0) {
+			if (!parsesize(&(*argv)[4], &lim->mem))
+				break;
+		} else if (strncmp(*argv, "cpu=", 4) == 0) {
+			cpus = strtod(&(*argv)[4], &end);
+			if (*end != '\0' || !(cpus > 0))
+				break;
+			lim->cpu = (long long)(cpus * CPUPERIOD);
+		} else if (strncmp(*argv, "pids=", 5) == 0) {
+			lim->pids = strtoll(&(*argv)[5], &end, 10);
+			if (*end != '\0' || lim->pids <= 0)
+				break;
+		} else if (!parserlimit(*argv, lim->rlim))
+			break;
+	}
+	if (*argv == NULL || strchr(*argv, '=') != NULL) {
+		if (*argv != NULL)
+			printf("limit: bad limit %s\n", *argv);
+		printf("usage: limit [mem=SIZE] [cpu=CPUS] [pids=N] "
+		    "[name=N ...] command [args]\n");
+		return (NULL);
+	}
+	return (argv);
+}
+
+/*
+ * Requires:
+ *   "str" is a properly terminated string.
+ *
+ * Effects:
+ *   Parses a positive size, such as "512K" or "2G", into "bytes".  Returns
+ *   false if "str" is not one.
+ */
+static bool
+parsesize(const char *str, long long *bytes)
+{
+	char *end;
+	const char *p;
+
+	errno = 0;
+	*bytes = strtoll(str, &end, 10);
+	if (end == str || *bytes <= 0 || errno != 0)
+		return (false);
+	if (*end != '\0') {
+		if (end[1] != '\0' || (p = strchr("KMGT", *end)) == NULL ||
+		    *bytes > LLONG_MAX >> 10 * (p - "KMGT" + 1))
+			return (false);
+		*bytes <<= 10 * (p - "KMGT" + 1);
+	}
+	return (true);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the cgroup v2 directory under which jobs get cgroups of their
+ *   own, opening it the first time: $TSH_CGROUP if set, and otherwise the
+ *   shell's own cgroup.  Enables the cpu, memory, and pids controllers for
+ *   its children where it can.  Returns -1 if there is no such cgroup or
+ *   the shell may not create cgroups in it.
+ */
+static int
+cgroup_root(void)
+{
+	char line[MAXLINE], mount[MAXLINE] = "", own[MAXLINE] = "";
+	char path[2 * MAXLINE];
+	const char *root = getenv("TSH_CGROUP");
+	static const char *const controllers[] = { "+cpu", "+memory", "+pids" };
+	size_t i;
+	FILE *fp;
+	int fd;
+
+	if (cgroot != -2)
+		return (cgroot);
+	cgroot = -1;
+	if (root == NULL) {
+		// Finds the cgroup2 mount and the shell's place in it.
+		if ((fp = fopen("/proc/self/mountinfo", "r")) == NULL)
+			return (cgroot);
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (strstr(line, " - cgroup2 ") != NULL &&
+			    sscanf(line, "%*s %*s %*s %*s %1023s", mount) == 1)
+				break;
+		fclose(fp);
+		if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+			return (cgroot);
+		while (fgets(line, sizeof(line), fp) != NULL)
+			if (sscanf(line, "0::%1023s", own) == 1)
+				break;
+		fclose(fp);
+		if (mount[0] == '\0' || own[0] == '\0')
+			return (cgroot);
+		snprintf(path, sizeof(path), "%s%s", mount, own);
+		root = path;
+	}
+	if ((fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return (cgroot);
+	if (faccessat(fd, "cgroup.procs", W_OK, 0) < 0) {
+		close(fd);
+		return (cgroot);
+	}
+	// Fails harmlessly if a controller is missing or already enabled.
+	for (i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+		int ctl = openat(fd, "cgroup.subtree_control", O_WRONLY);
+		if (ctl >= 0) {
+			if (write(ctl, controllers[i], strlen(controllers[i])) < 0)
+				errno = 0;
+			close(ctl);
+		}
+	}
+	cgroot = fd;
+	return (cgroot);
+}
+
+/*
+ * Requires:
+ *   "name" has room for "size" bytes.
+ *
+ * Effects:
+ *   Creates a cgroup for a new job under cgroup_root(), stores its name in
+ *   "name", writes the limits in "lim" into it, and returns an open
+ *   descriptor of it.  Returns -1, leaving nothing behind, if there is no
+ *   cgroup root or a limit's controller is not available.
+ */
+static int
+cgroup_create(const struct Limits *lim, char *name, size_t size)
+{
+	static int seq = 0;
+	char period[32];
+	int fd;
+
+	if (cgroup_root() < 0)
+		return (-1);
+	snprintf(name, size, "tsh.%d.%d", (int)getpid(), ++seq);
+	if (mkdirat(cgroot, name, 0755) < 0)
+		return (-1);
+	if ((fd = openat(cgroot, name, O_RDONLY | O_DIRECTORY |
+	    O_CLOEXEC)) < 0) {
+		unlinkat(cgroot, name, AT_REMOVEDIR);
+		return (-1);
+	}
+	snprintf(period, sizeof(period), " %d", CPUPERIOD);
+	if ((lim->mem >= 0 && !cgroup_write(fd, "memory.max", lim->mem,
+	    "")) || (lim->cpu >= 0 && !cgroup_write(fd, "cpu.max", lim->cpu,
+	    period)) || (lim->pids >= 0 && !cgroup_write(fd, "pids.max",
+	    lim->pids, ""))) {
+		close(fd);
+		unlinkat(cgroot, name, AT_REMOVEDIR);
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * Requires:
+ *   "cgfd" is an open cgroup directory, and "file" and "suffix" are
+ *   properly terminated strings.
+ *
+ * Effects:
+ *   Writes "value" followed by "suffix" to the cgroup's "file".  Returns
+ *   false if that fails, such as when the file's controller is not enabled.
+ */
+static bool
+cgroup_write(int cgfd, const char *file, long long value, const char *suffix)
+{
+	char buf[64];
+	int fd, n;
+	bool ok;
+
+	if ((fd = openat(cgfd, file, O_WRONLY | O_CLOEXEC)) < 0)
+		return (false);
+	n = snprintf(buf, sizeof(buf), "%lld%s", value, suffix);
+	ok = write(fd, buf, n) == n;
+	close(fd);
+	return (ok);
+}
+
+/*
+ * Requires:
+ *   "cgfd" is an open cgroup directory, and "file" and "key" are properly
+ *   terminated strings.
+ *
+ * Effects:
+ *   Returns the number after "key" in the cgroup's "file", or the first
+ *   number in it if "key" is empty.  Returns -1 if there is none.
+ */
+static long long
+cgroup_read(int cgfd, const char *file, const char *key)
+{
+	char buf[1024], *p;
+	ssize_t n;
+	int fd;
+
+	if ((fd = openat(cgfd, file, O_RDONLY | O_CLOEXEC)) < 0)
+		return (-1);
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return (-1);
+	buf[n] = '\0';
+	if (key[0] == '\0')
+		p = buf;
+	else if ((p = strstr(buf, key)) != NULL)
+		p += strlen(key);
+	else
+		return (-1);
+	return (isdigit((unsigned char)*p) ? strtoll(p, NULL, 10) : -1);
+}
+
+/*
+ * Requires:
+ *   "cgfd" is an open cgroup directory.
+ *
+ * Effects:
+ *   Forks a child directly into the cgroup with clone3(CLONE_INTO_CGROUP),
+ *   so that it never runs outside of it.  On kernels without it, forks
+ *   and has the child move itself into the cgroup before going on.
+ *   Returns as fork() does.
+ */
+static pid_t
+clone_into(int cgfd)
+{
+	struct clone_args args = { .flags = CLONE_INTO_CGROUP,
+	    .exit_signal = SIGCHLD, .cgroup = (unsigned int)cgfd };
+	pid_t pid;
+	int fd;
+
+	if ((pid = syscall(SYS_clone3, &args, sizeof(args))) >= 0)
+		return (pid);
+	if ((pid = Fork()) == 0) {
+		if ((fd = openat(cgfd, "cgroup.procs", O_WRONLY)) < 0 ||
+		    write(fd, "0", 1) != 1) {
+			printf("limit: cannot join the job's cgroup\n");
+			exit(126);
+		}
+		close(fd);
+	}
+	return (pid);
+}
+
+/*
+ * Requires:
+ *   "arg" is a properly terminated string, and "rlim" has NRLIMITS
+ *   entries, indexed like rlimits[].
+ *
+ * Effects:
+ *   Parses "arg" of the form "name=N", where "name" is in rlimits[] and N
+ *   is a count, a size with an optional K, M, G, or T suffix for the
+ *   "as" and "core" rlimits, or "unlimited", into its entry of "rlim".
+ *   Returns false if "arg" is not of that form.
+ */
+static bool
+parserlimit(const char *arg, long long *rlim)
+{
+	const char *value = strchr(arg, '=');
+	char *end;
+	int i;
+
+	if (value == NULL)
+		return (false);
+	for (i = 0; i < NRLIMITS; i++)
+		if (strncmp(rlimits[i].name, arg, value - arg) == 0 &&
+		    rlimits[i].name[value - arg] == '\0')
+			break;
+	if (i == NRLIMITS)
+		return (false);
+	value++;
+	if (strcmp(value, "unlimited") == 0)
+		rlim[i] = LLONG_MAX;
+	else if (rlimits[i].size && strcmp(value, "0") != 0)
+		return (parsesize(value, &rlim[i]));
+	else {
+		rlim[i] = strtoll(value, &end, 10);
+		if (end == value || *end != '\0' || rlim[i] < 0)
+			return (false);
+	}
+	return (true);
+}
+
+/*
+ * Requires:
+ *   Called in the child of a job, before it executes its program.
+ *
+ * Effects:
+ *   Sets the rlimits in "lim", both the soft and the hard limit, so that
+ *   the job cannot raise them again.  Prints an error and exits if one
+ *   cannot be set, such as when it exceeds the shell's own hard limit.
+ */
+static void
+apply_rlimits(const struct Limits *lim)
+{
+	struct rlimit rl;
+	int i;
+
+	for (i = 0; i < NRLIMITS; i++) {
+		if (lim->rlim[i] < 0)
+			continue;
+		rl.rlim_cur = rl.rlim_max = lim->rlim[i] == LLONG_MAX ?
+		    RLIM_INFINITY : (rlim_t)lim->rlim[i];
+		if (setrlimit(rlimits[i].resource, &rl) < 0) {
+			printf("limit: %s: %s\n", rlimits[i].name,
+			    strerror(errno));
+			exit(126);
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Prints "name" and the rlimit "value" as ulimit and prlimit list them.
+ */
+static void
+print_rlimit(const char *name, rlim_t value)
+{
+
+	if (value == RLIM_INFINITY)
+		printf("%-8s unlimited\n", name);
+	else
+		printf("%-8s %llu\n", name, (unsigned long long)value);
+}
+
+/*
+ * Requires:
+ *   "job" is a job in the jobs list.
+ *
+ * Effects:
+ *   Prints the job's CPU time and peak memory, read from its cgroup's
+ *   cpu.stat and memory.peak (memory.current on kernels without it), if it
+ *   was started with limits.
+ */
+static void
+print_usage(JobP job)
+{
+	long long usec, mem;
+
+	if (job->rlimited) {
+		printf("    limited with setrlimit; no usage recorded\n");
+		return;
+	}
+	if (job->cgfd < 0)
+		return;
+	usec = cgroup_read(job->cgfd, "cpu.stat", "usage_usec ");
+	if ((mem = cgroup_read(job->cgfd, "memory.peak", "")) < 0)
+		mem = cgroup_read(job->cgfd, "memory.current", "");
+	printf("    cgroup %s: cpu %.2f s", job->cgname, usec / 1e6);
+	if (mem >= 0)
+		printf(", memory peak %.1f MB", mem / 1048576.0);
+	printf("\n");
+}
+
+/*
+ * Requires:
+ *   SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Returns true if the job "pid" is running in the background, or, if
+ *   "pid" is -1, if any background job of "client" (-1 outside of a
+ *   server) is.
+ */
+static bool
+running(pid_t pid, int client)
+{
+	int i;
+
+	for (i = 0; i < MAXJOBS; i++)
+		if (jobs[i].pid != 0 && jobs[i].state == BG &&
+		    (pid > 0 ? jobs[i].pid == pid : jobs[i].client == client))
+			return (true);
+	return (false);
+}
+
+/*
+ * Requires:
+ *   "path" is a properly terminated string.
+ *
+ * Effects:
+ *   Runs the shell as a server for the clients (tshc) that connect to the
+ *   Unix domain socket "path", and never returns.  One process owns the
+ *   jobs of every client and waits for all of them with a single ppoll(),
+ *   so that clients cost no thread or process of their own.  A line that
+ *   must wait for a foreground job, or for "wait", is put aside and resumed
+ *   when the job is done, so that other clients are served meanwhile.
+ *   What the shell writes for a client is queued and sent as the socket
+ *   takes it, so a client that stops reading only holds up itself.
+ */
+static void
+serve(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction action;
+	struct pollfd *fds;
+	struct Client **owner;
+	struct Capture **capowner;
+	struct stat sb;
+	sigset_t mask, waitmask;
+	int lsock, i, nfds;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		app_error("socket path too long");
+	strcpy(addr.sun_path, path);
+	// Replaces the socket of an earlier server, but nothing else.
+	if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+		unlink(path);
+	if ((lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC |
+	    SOCK_NONBLOCK, 0)) < 0)
+		unix_error("socket error");
+	if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		unix_error("bind error");
+	if (listen(lsock, SOMAXCONN) < 0)
+		unix_error("listen error");
+
+	action.sa_handler = sigpipe_handler;
+	action.sa_flags = SA_RESTART;
+	if (sigemptyset(&action.sa_mask) < 0)
+		unix_error("sigemptyset error");
+	if (sigaction(SIGPIPE, &action, NULL) < 0)
+		unix_error("sigaction error");
+	for (i = 0; i < 3; i++)
+		if ((serverfd[i] = fcntl(i, F_DUPFD_CLOEXEC, 3)) < 0)
+			unix_error("fcntl error");
+	serverpid = getpid();
+	serverout = stdout;
+	if ((clientout = fopencookie(NULL, "w", (cookie_io_functions_t){
+	    .write = serve_write })) == NULL)
+		unix_error("fopencookie error");
+	clients = Malloc(MAXCLIENTS * sizeof(*clients));
+	for (i = 0; i < MAXCLIENTS; i++) {
+		clients[i].sock = -1;
+		clients[i].out = NULL;
+	}
+	fds = Malloc((1 + MAXCLIENTS + MAXJOBS) * sizeof(*fds));
+	owner = Malloc((1 + MAXCLIENTS + MAXJOBS) * sizeof(*owner));
+	capowner = Malloc((1 + MAXCLIENTS + MAXJOBS) * sizeof(*capowner));
+
+	// SIGCHLD only comes in while the server waits in ppoll().
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &waitmask);
+	sigdelset(&waitmask, SIGCHLD);
+	while (true) {
+		nfds = 0;
+		fds[nfds] = (struct pollfd){ .fd = lsock, .events = POLLIN };
+		owner[nfds] = NULL;
+		capowner[nfds++] = NULL;
+		for (i = 0; i < nclients; i++) {
+			if (clients[i].sock < 0)
+				continue;
+			fds[nfds] = (struct pollfd){ .fd = clients[i].sock,
+			    .events = clients[i].outlen > 0 ? POLLIN | POLLOUT :
+			    POLLIN };
+			owner[nfds] = &clients[i];
+			capowner[nfds++] = NULL;
+		}
+		for (i = 0; i < MAXJOBS; i++) {
+			if (captures[i].fd < 0 || captures[i].jid == 0)
+				continue;
+			fds[nfds] = (struct pollfd){ .fd = captures[i].fd,
+			    .events = POLLIN };
+			owner[nfds] = NULL;
+			capowner[nfds++] = &captures[i];
+		}
+		if (ppoll(fds, nfds, NULL, &waitmask) < 0 && errno != EINTR)
+			unix_error("ppoll error");
+		serve_notes();
+		if (fds[0].revents != 0)
+			serve_accept(lsock);
+		for (i = 1; i < nfds; i++) {
+			if ((fds[i].revents & ~POLLOUT) == 0)
+				continue;
+			if (owner[i] != NULL && owner[i]->sock >= 0)
+				serve_input(owner[i]);
+			else if (capowner[i] != NULL)
+				drain_capture(capowner[i]);
+		}
+		// Resumes the lines of clients whose jobs are done.
+		for (i = 0; i < nclients; i++)
+			if (clients[i].sock >= 0 && clients[i].waiting != 0 &&
+			    serve_waited(&clients[i]))
+				serve_eval(&clients[i]);
+		// Then resumes held lines while there is room for their jobs.
+		for (i = 0; i < nclients && !jobsfull(jobs); i++) {
+			if (clients[i].sock >= 0 && clients[i].held) {
+				clients[i].held = false;
+				serve_eval(&clients[i]);
+			}
+		}
+		// Sends what is queued, and lets go of the clients that are done.
+		for (i = 0; i < nclients; i++)
+			if (clients[i].sock >= 0 && (clients[i].outlen > 0 ||
+			    clients[i].quit || clients[i].broken))
+				serve_flush(&clients[i]);
+	}
+}
+
+/*
+ * Requires:
+ *   "lsock" is the server's listening socket.
+ *
+ * Effects:
+ *   Accepts every pending connection into a free client slot.  Refuses
+ *   connections beyond MAXCLIENTS.
+ */
+static void
+serve_accept(int lsock)
+{
+	struct Client *c;
+	int sock, i;
+
+	while ((sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC |
+	    SOCK_NONBLOCK)) >= 0) {
+		for (i = 0; i < MAXCLIENTS && clients[i].sock >= 0; i++)
+			;
+		if (i == MAXCLIENTS) {
+			close(sock);
+			continue;
+		}
+		if (i == nclients)
+			nclients++;
+		c = &clients[i];
+		c->sock = sock;
+		c->fd[0] = c->fd[1] = c->fd[2] = -1;
+		c->inlen = 0;
+		c->line[0] = '\0';
+		c->laststatus = 0;
+		c->waiting = 0;
+		c->held = false;
+		c->syncing = false;
+		c->unsynced = false;
+		c->quit = false;
+		c->broken = false;
+		c->outlen = 0;
+		c->outsize = 0;
+	}
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Reads what the client sent and handles it with serve_frames().  Drops
+ *   the client at end of file.
+ */
+static void
+serve_input(struct Client *c)
+{
+	ssize_t n;
+	int fds[3], nfds, i;
+
+	n = srv_recv(c->sock, &c->in[c->inlen], sizeof(c->in) - c->inlen,
+	    fds, 3, &nfds);
+	if (n < 0 && errno == EAGAIN)
+		return;
+	if (nfds == 3 && c->fd[0] < 0)
+		memcpy(c->fd, fds, sizeof(fds));
+	else
+		for (i = 0; i < nfds; i++)
+			close(fds[i]);
+	if (n <= 0) {
+		serve_drop(c);
+		return;
+	}
+	c->inlen += n;
+	serve_frames(c);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Handles every whole frame that the client sent.  A command line is
+ *   evaluated right away; only a command that needs a job slot while the
+ *   job table is full is held back, with the rest of its line, until a
+ *   slot frees.  A line that waits for SRV_SYNC goes on when it comes.  The
+ *   client must wait for a line's SRV_DONE before sending the next one.
+ *   Drops the client if it breaks the protocol, as by sending a signal
+ *   other than SIGINT or SIGTSTP.
+ */
+static void
+serve_frames(struct Client *c)
+{
+	const char *payload;
+	size_t plen;
+	ssize_t size;
+	int type;
+
+	while ((size = srv_frame(c->in, c->inlen, &type, &payload,
+	    &plen)) > 0) {
+		if (type == SRV_CMD && c->fd[0] >= 0 && c->waiting == 0 &&
+		    !c->held && !c->syncing && !c->quit &&
+		    plen < sizeof(c->line) - 1) {
+			// Ends the line with a newline, as if it were typed.
+			memcpy(c->line, payload, plen);
+			if (plen == 0 || c->line[plen - 1] != '\n')
+				c->line[plen++] = '\n';
+			c->line[plen] = '\0';
+			c->pos = 0;
+			c->op = TOK_SEQ;
+			serve_eval(c);
+		} else if (type == SRV_SIGNAL && plen == 1 &&
+		    (payload[0] == SIGINT || payload[0] == SIGTSTP))
+			serve_signal(c, payload[0]);
+		else if (type == SRV_SYNC && plen == 0 && c->syncing) {
+			c->syncing = false;
+			serve_eval(c);
+		} else if (type != SRV_HELLO)
+			size = -1;
+		if (size < 0 || c->sock < 0)
+			break;
+		c->inlen -= size;
+		memmove(c->in, &c->in[size], c->inlen);
+	}
+	if (size < 0)
+		serve_drop(c);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Evaluates the client's line from where it stopped, with the client's
+ *   stdin, stdout, and stderr in place of the server's for its jobs, and
+ *   its own $?.  The shell's own output is queued for the client instead.
+ *   If the line is done, queues SRV_DONE with the line's status, or SRV_BYE
+ *   after quit, for the server to send before it drops the client.
+ */
+static void
+serve_eval(struct Client *c)
+{
+	sigset_t mask;
+	unsigned char status;
+	bool done;
+	int i;
+
+	current = c;
+	laststatus = c->laststatus;
+	c->waiting = 0;
+	// Flushes first, or a child could write the server's output again.
+	fflush(stdout);
+	for (i = 0; i < 3; i++)
+		dup2(c->fd[i], i);
+	stdout = clientout;
+	done = eval_from(c->line, &c->pos, &c->op);
+	fflush(stdout);
+	stdout = serverout;
+	for (i = 0; i < 3; i++)
+		dup2(serverfd[i], i);
+	// eval_command() lets SIGCHLD in again.
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, NULL);
+	serve_notes();
+	c->laststatus = laststatus;
+	current = NULL;
+	status = laststatus;
+	if (c->quit)
+		serve_queue(c, SRV_BYE, NULL, 0);
+	else if (done)
+		serve_queue(c, SRV_DONE, &status, 1);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client, "data" holds "len" bytes, and SIGCHLD is
+ *   blocked.
+ *
+ * Effects:
+ *   Queues "data" for the client in frames of the given type, as many as
+ *   it takes.  Marks the client broken instead, for serve_flush() to drop,
+ *   if it has MAXOUTPUT bytes queued already.
+ */
+static void
+serve_queue(struct Client *c, int type, const void *data, size_t len)
+{
+	const char *p = data;
+	uint32_t n;
+	size_t chunk;
+
+	// The client writes what precedes SRV_DONE before its next line.
+	if (type == SRV_OUT)
+		c->unsynced = true;
+	else if (type == SRV_DONE)
+		c->unsynced = false;
+	do {
+		chunk = len < SRV_MAXFRAME - SRV_HEADER ? len :
+		    SRV_MAXFRAME - SRV_HEADER;
+		while (c->outlen + SRV_HEADER + chunk > c->outsize) {
+			if (c->outsize >= MAXOUTPUT) {
+				c->broken = true;
+				return;
+			}
+			c->outsize = c->outsize > 0 ? 2 * c->outsize :
+			    4 * SRV_MAXFRAME;
+			if ((c->out = realloc(c->out, c->outsize)) == NULL)
+				unix_error("realloc error");
+		}
+		n = htonl(chunk + 1);
+		memcpy(&c->out[c->outlen], &n, 4);
+		c->out[c->outlen + 4] = type;
+		if (chunk > 0)
+			memcpy(&c->out[c->outlen + SRV_HEADER], p, chunk);
+		c->outlen += SRV_HEADER + chunk;
+		p += chunk;
+		len -= chunk;
+	} while (len > 0);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Sends as much of what is queued for the client as the socket takes
+ *   without blocking.  Drops the client if it is broken, or once all of
+ *   it is sent after quit.
+ */
+static void
+serve_flush(struct Client *c)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (!c->broken && off < c->outlen) {
+		n = send(c->sock, &c->out[off], c->outlen - off,
+		    MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n >= 0)
+			off += n;
+		else if (errno == EAGAIN)
+			break;
+		else if (errno != EINTR)
+			c->broken = true;
+	}
+	c->outlen -= off;
+	memmove(c->out, &c->out[off], c->outlen);
+	if (c->broken || (c->quit && c->outlen == 0))
+		serve_drop(c);
+}
+
+/*
+ * Requires:
+ *   SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Queues the job notifications that sigchld_handler() left for clients
+ *   for them, and empties them.
+ */
+static void
+serve_notes(void)
+{
+	size_t off, len;
+	int i;
+
+	for (off = 0; off + 3 <= nclientnotes; off += 3 + len) {
+		i = (unsigned char)clientnotes[off] << 8 |
+		    (unsigned char)clientnotes[off + 1];
+		len = (unsigned char)clientnotes[off + 2];
+		if (clients[i].sock >= 0)
+			serve_queue(&clients[i], SRV_OUT, &clientnotes[off + 3],
+			    len);
+	}
+	nclientnotes = 0;
+}
+
+/*
+ * Requires:
+ *   "c" is the client whose line is running.
+ *
+ * Effects:
+ *   Returns false if the client has been sent no output since it last
+ *   answered SRV_SYNC.  Otherwise queues SRV_SYNC and returns true, and
+ *   the line must stop until the answer comes, so that a job it starts
+ *   cannot write to the client's stdout ahead of the shell's output.
+ */
+static bool
+serve_sync(struct Client *c)
+{
+
+	fflush(stdout);
+	if (!c->unsynced)
+		return (false);
+	serve_queue(c, SRV_SYNC, NULL, 0);
+	c->unsynced = false;
+	c->syncing = true;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "buf" holds "size" bytes.
+ *
+ * Effects:
+ *   Writes "buf" for clientout: queues it for the client whose line is
+ *   running, or, in a child of the server, which has the client's stdout
+ *   as its own, writes it there.  Returns the number of bytes taken.
+ */
+static ssize_t
+serve_write(void *cookie, const char *buf, size_t size)
+{
+
+	// Prevents an "unused parameter" warning.
+	(void)cookie;
+	if (getpid() != serverpid)
+		return (write(STDOUT_FILENO, buf, size));
+	if (current != NULL)
+		serve_queue(current, SRV_OUT, buf, size);
+	return (size);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client, "sig" is SIGINT or SIGTSTP, and SIGCHLD is
+ *   blocked.
+ *
+ * Effects:
+ *   Sends "sig", which the client got from its terminal, to the job that
+ *   its line waits for in the foreground.  ctrl-c also ends a "wait", and
+ *   gives up a line that is held for a job slot, with status 130.
+ *   Otherwise does nothing.
+ */
+static void
+serve_signal(struct Client *c, int sig)
+{
+	unsigned char status = 128 + sig;
+
+	if (c->held && sig == SIGINT) {
+		c->held = false;
+		c->laststatus = status;
+		serve_queue(c, SRV_DONE, &status, 1);
+	} else if (c->waiting > 0 && c->waitfg) {
+		kill(-c->waiting, sig);
+		// The counters have room for valid signal numbers only.
+		if (sig > 0 && sig < NSIG)
+			stats.forwarded[sig]++;
+	} else if (c->waiting != 0 && sig == SIGINT) {
+		c->laststatus = 128 + sig;
+		serve_eval(c);
+	}
+}
+
+/*
+ * Requires:
+ *   "c" is a client whose line waits, and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Returns true, after setting the client's $?, if what the line waits
+ *   for is done: its foreground job terminated or stopped, or the jobs
+ *   that "wait" waits for are no longer running.
+ */
+static bool
+serve_waited(struct Client *c)
+{
+	JobP job;
+	int i;
+
+	if (!c->waitfg) {
+		if (running(c->waiting, c - clients))
+			return (false);
+		c->laststatus = 0;
+		return (true);
+	}
+	for (i = 0; i < MAXJOBS; i++) {
+		if (fgdone[i].pid == c->waiting) {
+			c->laststatus = fgdone[i].status;
+			fgdone[i].pid = 0;
+			return (true);
+		}
+	}
+	// Another client may have put the job in the background.
+	if ((job = getjobpid(jobs, c->waiting)) == NULL || job->state != FG) {
+		c->laststatus = 0;
+		return (true);
+	}
+	return (false);
+}
+
+/*
+ * Requires:
+ *   "c" is a connected client and SIGCHLD is blocked.
+ *
+ * Effects:
+ *   Closes the client's connection and descriptors and frees its slot.
+ *   Its jobs keep running in the background, reporting to the server's own
+ *   stdout.
+ */
+static void
+serve_drop(struct Client *c)
+{
+	int i;
+
+	// Leaves no notifications for the next client in the slot.
+	serve_notes();
+	for (i = 0; i < MAXJOBS; i++) {
+		if (jobs[i].pid == 0 || jobs[i].client != c - clients)
+			continue;
+		jobs[i].client = -1;
+		if (jobs[i].state == FG)
+			jobs[i].state = BG;
+	}
+	for (i = 0; i < MAXJOBS; i++)
+		if (c->waitfg && fgdone[i].pid == c->waiting)
+			fgdone[i].pid = 0;
+	for (i = 0; i < 3; i++)
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+	close(c->sock);
+	c->sock = -1;
+	free(c->out);
+	c->out = NULL;
+	while (nclients > 0 && clients[nclients - 1].sock < 0)
+		nclients--;
+}
+
+
+/*
+ * Requires:
+ *   Nothing. 
+ *
+ * Effects:
+ *   Runs a tiny shell program that takes one of four
+ *   built in commands and that command's arguments or an 
+ *   executable and its arguments. 
+ */
+int
+main(int argc, char **argv) 
+{
+	// The shell's signal handlers and the signals each one blocks.
+	static const struct {
+		int signum;
+		void (*handler)(int);
+		int block[2];
+	} handlers[] = {
+		{ SIGINT, sigint_handler, { SIGTSTP, SIGCHLD } },   // ctrl-c
+		{ SIGTSTP, sigtstp_handler, { SIGINT, SIGCHLD } },  // ctrl-z
+		{ SIGCHLD, sigchld_handler, { SIGTSTP, SIGINT } },
+		{ SIGQUIT, sigquit_handler, { 0, 0 } },
+	};
+	struct sigaction action;
+	long long start = monotonic_ns(), times[3];
+	size_t i, j;
+	
+	int c, status;
+	char cmdline[MAXLINE];
+	const char *command = NULL, *sockpath = NULL;
+	bool emit_prompt = true;	// Emit a prompt by default.
+	static const struct option longopts[] = {
+		{ "record", required_argument, NULL, 'R' },
+		{ "serve", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	/*
+	 * Redirect stderr to stdout (so that driver will get all output
+	 * on the pipe connected to stdout).
+	 */
+	if (dup2(1, 2) < 0)
+		unix_error("dup2 error");
+
+	// Parse the command line.
+	while ((c = getopt_long(argc, argv, "hvpTc:o:", longopts,
+	    NULL)) != -1) {
+		switch (c) {
+		case 'R':             // Record the session's events.
+			if ((recordfd = open(optarg, O_WRONLY | O_CREAT |
+			    O_TRUNC | O_APPEND | O_CLOEXEC, 0666)) < 0)
+				unix_error(optarg);
+			recordstart = start;
+			break;
+		case 'S':             // Serve clients on a socket.
+			sockpath = optarg;
+			break;
+		case 'c':             // Run one command line and exit.
+			oneshot = true;
+			command = optarg;
+			break;
+		case 'h':             // Print a help message.
+			usage();
+			break;
+		case 'v':             // Emit additional diagnostic info.
+			verbose = true;
+			break;
+		case 'p':             // Don't print a prompt.
+			// This is handy for automatic testing.
+			emit_prompt = false;
+			break;
+		case 'T':             // Report startup times.
+			timing = true;
+			break;
+		case 'o':             // Enable a shell option.
+			if ((status = setoption(optarg, true)) < 0)
+				usage();
+			if (status > 0)
+				exit(1);
+			break;
+		default:
+			usage();
+		}
+	}
+	times[0] = timing ? monotonic_ns() : 0;
+
+	/*
+	 * Install the signal handlers, each blocking the signals listed with it
+	 * while it runs.  sigquit_handler() provides a clean way for the test
+	 * harness to terminate the shell, and preemption of the processor by
+	 * the other handlers does it no harm, so it blocks nothing.
+	 */
+	for (i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+		action.sa_handler = handlers[i].handler;
+		action.sa_flags = SA_RESTART;
+		if (sigemptyset(&action.sa_mask) < 0)
+			unix_error("sigemptyset error");
+		for (j = 0; j < 2 && handlers[i].block[j] != 0; j++)
+			Sigaddset(&action.sa_mask, handlers[i].block[j]);
+		if (sigaction(handlers[i].signum, &action, NULL) < 0)
+			unix_error("sigaction error");
+	}
+	times[1] = timing ? monotonic_ns() : 0;
+
+	// Run a script instead of reading commands from stdin.
+	if (optind < argc) {
+		if ((stdinput.fd = open(argv[optind], O_RDONLY | O_CLOEXEC)) < 0)
+			unix_error(argv[optind]);
+		emit_prompt = false;
+	}
+	// Coalesce output unless a person is watching it.
+	flush_each = isatty(STDOUT_FILENO);
+
+	/*
+	 * The search path is split the first time a command is looked up, so
+	 * a shell that only runs builtins or commands with a '/' never does.
+	 */
+
+	// Initialize the jobs list.
+	initjobs(jobs);
+	if (timing) {
+		times[2] = monotonic_ns();
+		printf("startup: options %lld us, signals %lld us, jobs %lld "
+		    "us, path deferred; %lld us to the first prompt\n",
+		    (times[0] - start) / 1000, (times[1] - times[0]) / 1000,
+		    (times[2] - times[1]) / 1000, (times[2] - start) / 1000);
+	}
+
+	// Serve clients instead of reading commands.
+	if (sockpath != NULL)
+		serve(sockpath);
+
+	// Run the -c command line, adding the newline a typed line ends with.
+	if (oneshot) {
+		snprintf(cmdline, sizeof(cmdline), "%s\n", command);
+		record_line('C', cmdline);
+		eval(cmdline);
+		print_notes();
+		exit(laststatus);
+	}
+
+	// Execute the shell's read/eval loop.
+	while (true) {
+
+		// Reports the jobs that changed state since the last prompt.
+		if (nnotes > 0)
+			print_notes();
+
+		// Read the command line.
+		if (emit_prompt) {
+			printf("%s", prompt);
+			fflush(stdout);
+		}
+		record('P', -1, 0, "", "");
+		if (!readcmd(cmdline, MAXLINE)) { // End of file (ctrl-d)
+			print_notes();
+			exit(0);
+		}
+		record_line('L', cmdline);
+
+		// Evaluate the command line.
+		eval(cmdline);
+		if (flush_each)
+			fflush(stdout);
+	}
+
+	// Control never reaches here.
+	assert(false);
+}
+  
+/*
+ * eval - Evaluate the command line that the user has just typed in.
+ *
+ * The line is a list of commands separated by ";", "&", "&&", or "||".
+ * Each command is tokenized right before it runs, so that "$?" sees the
+ * status of the command before it, and is then evaluated by
+ * eval_command().  A command after "&&" only runs if the previous command
+ * succeeded, and a command after "||" only runs if it failed, without
+ * creating any extra process.
+ *
+ * Requires:
+ *   A properly terminated commandline string.
+ *
+ * Effects:
+ *   Evaluates every command of the list that the operators call for and
+ *   updates laststatus ($?) after each one.  Prints an error and sets
+ *   laststatus to 2 if the line has a syntax error.
+ */
+static void
+eval(const char *cmdline)
+{
+	size_t pos = 0;
+	int op = TOK_SEQ;
+
+	eval_from(cmdline, &pos, &op);
+}
+
+/*
+ * Requires:
+ *   "cmdline" is a properly terminated command line, "*pos" is the offset
+ *   of one of its commands, and "*op" is the operator before that command,
+ *   or TOK_SEQ for the first one.
+ *
+ * Effects:
+ *   Evaluates the line from "*pos" on as eval() does.  For a server's
+ *   client, stops after a command that the client must wait for, or
+ *   before one that is held until a job slot frees or that must wait for
+ *   the client to write the shell's output, leaving "*pos" and "*op"
+ *   where the evaluation resumes, and returns false.  A held
+ *   command's words are expanded again when it resumes.
+ *   Otherwise returns true once the line is done.
+ */
+static bool
+eval_from(const char *cmdline, size_t *pos, int *op)
+{
+	char arena[2 * MAXLINE + MAXSUBST]; // the current command's words
+	char *argv[MAXARGS];
+	char text[MAXLINE + 3];   // the current command's job text
+	struct Tokens t = { .words = argv, .maxwords = MAXARGS,
+	    .arena = arena, .size = sizeof(arena) };
+	size_t len = strlen(cmdline), start;
+	int term, before;
+	bool skip;
+
+	do {
+		// Lets a client write the shell's output before a job's.
+		if (current != NULL && serve_sync(current))
+			return (false);
+		// Short-circuits, leaving $? unchanged and expanding nothing.
+		skip = (*op == TOK_AND && laststatus != 0) ||
+		    (*op == TOK_OR && laststatus == 0);
+		before = *op;
+		t.expand = skip ? NULL : expand;
+		start = *pos;
+		term = tokenize(cmdline, len, pos, &t);
+		if (term == TOK_ERROR || term == TOK_PIPE) {
+			printf("tsh: %s\n", term == TOK_ERROR ? t.error :
+			    "pipelines are not supported");
+			laststatus = 2;
+			return (true);
+		}
+		if (t.nwords == 0)
+			continue;
+		// A loop takes its "do" and "done" parts of the line too.
+		if (strcmp(argv[0], "for") == 0 ||
+		    strcmp(argv[0], "repeat") == 0) {
+			int status = eval_loop(argv, cmdline, len, pos, &term,
+			    skip);
+			if (term == TOK_ERROR) {
+				laststatus = 2;
+				return (true);
+			}
+			*op = term;
+			if (!skip)
+				laststatus = status;
+			continue;
+		}
+		*op = term;
+		if (skip)
+			continue;
+
+		/*
+		 * A command that is the whole line keeps the line as its job
+		 * text.  Otherwise the text is the command's own part of the
+		 * line.
+		 */
+		lastcommand = oneshot && term == TOK_END;
+		if (start == 0 && cmdline[*pos + strspn(&cmdline[*pos],
+		    " \t\n")] == '\0') {
+			laststatus = eval_command(argv, term == TOK_BG,
+			    cmdline);
+		} else {
+			snprintf(text, sizeof(text), "%.*s%s\n",
+			    (int)(t.end - t.start), &cmdline[t.start],
+			    term == TOK_BG ? " &" : "");
+			laststatus = eval_command(argv, term == TOK_BG, text);
+		}
+		if (current != NULL && current->quit)
+			return (true);
+		if (current != NULL && current->waiting != 0)
+			return (false);
+		// A held command runs again, from its words, once it can.
+		if (current != NULL && current->held) {
+			*pos = start;
+			*op = before;
+			return (false);
+		}
+	} while (term != TOK_END);
+	return (true);
+}
+
+/*
+ * eval_loop - Evaluate a "repeat" or "for" loop.
+ *
+ * The loops are
+ *   repeat [-j max] count command [args ...]
+ *   for [-j max] name in [words ...]; do command [args ...]; done
+ * and their command is tokenized once, with "$?" and "$(...)" expanded
+ * then, into a template.  Each iteration only replaces "$name" and
+ * "${name}" in the template's words with the next word, unless their
+ * '$' was single-quoted or escaped, and runs the result with
+ * eval_command().  A loop whose command ends with "&" instead
+ * of ";" runs each iteration as a background job, waiting first while
+ * "max" (by default MAXJOBS) jobs are running in the background.  ctrl-c
+ * ends the loop.
+ *
+ * Requires:
+ *   "argv" is the loop's first command, tokenized from "cmdline" ("len"
+ *   bytes), which "*pos" points just past, and "*term" is its terminator.
+ *
+ * Effects:
+ *   Tokenizes the rest of a "for" loop, leaving "*pos" past its "done"
+ *   and "*term" set to the terminator of "done".  Unless "skip" is true,
+ *   runs the loop and returns the exit status of its last foreground
+ *   iteration, or 130 if it was interrupted.  Prints an error and sets
+ *   "*term" to TOK_ERROR if the loop is malformed.
+ */
+static int
+eval_loop(char **argv, const char *cmdline, size_t len, size_t *pos,
+    int *term, bool skip)
+{
+	char arena[2 * MAXLINE + MAXSUBST]; // the template's words
+	char *body[MAXARGS], *words[MAXARGS], *done[2];
+	char buf[4 * MAXLINE], text[MAXLINE + 3], *end = NULL;
+	size_t dollars[MAXLINE]; // the template's expandable '$'s
+	struct Tokens t = { .words = body, .maxwords = MAXARGS,
+	    .arena = arena, .size = sizeof(arena), .dollars = dollars,
+	    .maxdollars = MAXLINE };
+	struct Tokens d = { .words = done, .maxwords = 2, .arena = buf,
+	    .size = sizeof(buf) };
+	bool is_for = strcmp(argv[0], "for") == 0, is_bg, ok, spliced;
+	bool subst[MAXARGS];
+	char **template, **values = NULL, *name = NULL;
+	const char *w;
+	long count = 0, i;
+	int max = MAXJOBS, first = 1, status = 0, j, n;
+	size_t used, k;
+
+	if (argv[1] != NULL && strcmp(argv[1], "-j") == 0) {
+		// Without a value, "max" fails the usage check below.
+		max = argv[2] != NULL ? atoi(argv[2]) : 0;
+		first = argv[2] != NULL ? 3 : 2;
+	}
+	if (is_for) {
+		ok = argv[first] != NULL && argv[first + 1] != NULL &&
+		    strcmp(argv[first + 1], "in") == 0 && *term == TOK_SEQ;
+		// The command follows "do", and "done" ends the loop.
+		t.expand = skip ? NULL : expand;
+		n = ok ? tokenize(cmdline, len, pos, &t) : TOK_ERROR;
+		ok = (n == TOK_SEQ || n == TOK_BG) && t.nwords > 1 &&
+		    strcmp(body[0], "do") == 0;
+		*term = ok ? tokenize(cmdline, len, pos, &d) : TOK_ERROR;
+		ok = ok && *term != TOK_ERROR && *term != TOK_BG &&
+		    *term != TOK_PIPE && d.nwords == 1 &&
+		    strcmp(done[0], "done") == 0;
+		name = argv[first];
+		for (values = &argv[first + 2]; ok && values[count] != NULL;
+		    count++)
+			;
+		template = &body[1];
+		is_bg = n == TOK_BG;
+	} else {
+		if (argv[first] != NULL)
+			count = strtol(argv[first], &end, 10);
+		ok = end != NULL && end != argv[first] && *end == '\0' &&
+		    count >= 0 && argv[first + 1] != NULL &&
+		    *term != TOK_PIPE;
+		template = &argv[first + 1];
+		is_bg = *term == TOK_BG;
+	}
+	if (!ok || max < 1 || max > MAXJOBS) {
+		printf("tsh: usage: %s\n", is_for ? "for [-j max] name in "
+		    "[words ...]; do command; done" : "repeat [-j max] count "
+		    "command");
+		*term = TOK_ERROR;
+		return (2);
+	}
+	if (skip)
+		return (0);
+	// A server cannot wait for the iterations without blocking.
+	if (current != NULL) {
+		printf("%s: not available to server clients\n", argv[0]);
+		return (1);
+	}
+
+	// Finds the words that use the variable, once.
+	for (spliced = false, j = 0; template[j] != NULL; j++) {
+		for (subst[j] = false, w = template[j]; is_for && *w != '\0' &&
+		    !subst[j]; w++)
+			subst[j] = varref(w, name, &t) > 0;
+		spliced |= subst[j];
+	}
+
+	for (i = 0; i < count; i++) {
+		// Splices the word into a copy of each word that uses it.
+		for (used = 0, j = 0; template[j] != NULL; j++) {
+			words[j] = template[j];
+			if (!subst[j])
+				continue;
+			words[j] = &buf[used];
+			for (w = template[j]; *w != '\0' && used <
+			    sizeof(buf) - 1; ) {
+				if ((k = varref(w, name, &t)) == 0) {
+					buf[used++] = *w++;
+					continue;
+				}
+				n = snprintf(&buf[used], sizeof(buf) - used,
+				    "%s", values[i]);
+				used = (size_t)n < sizeof(buf) - used ?
+				    used + n : sizeof(buf) - 1;
+				w += k;
+			}
+			buf[used++] = '\0';
+			if (used == sizeof(buf)) {
+				printf("tsh: %s: command too long\n", argv[0]);
+				return (2);
+			}
+		}
+		words[j] = NULL;
+		// The job text is the spliced command.
+		if (i == 0 || spliced)
+			jointext(words, is_bg, text);
+
+		if (is_bg && !loop_slot(max))
+			return (130);
+		lastcommand = false;
+		status = eval_command(words, is_bg, text);
+		if (status == 128 + SIGINT)
+			break;
+	}
+	return (status);
+}
+
+/*
+ * Requires:
+ *   "w" and "name" are properly terminated strings, and "w" points into
+ *   the arena of "t".
+ *
+ * Effects:
+ *   Returns the length of the "$name" or "${name}" that "w" starts with,
+ *   or 0 if it starts with neither or its '$' was single-quoted or
+ *   escaped.
+ */
+static size_t
+varref(const char *w, const char *name, const struct Tokens *t)
+{
+	size_t n = strlen(name);
+	int i;
+
+	if (w[0] != '$')
+		return (0);
+	for (i = 0; i < t->ndollars && t->arena + t->dollars[i] != w; i++)
+		;
+	if (i == t->ndollars)
+		return (0);
+	if (w[1] == '{' && strncmp(&w[2], name, n) == 0 && w[n + 2] == '}')
+		return (n + 3);
+	if (strncmp(&w[1], name, n) == 0 && !isalnum((unsigned char)w[n + 1])
+	    && w[n + 1] != '_')
+		return (n + 1);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "words" is a NULL-terminated array of strings, and "text" has room
+ *   for MAXLINE + 3 characters.
+ *
+ * Effects:
+ *   Stores the words, separated by spaces and followed by " &" if "is_bg"
+ *   is true and a newline, as a job's text, cutting them short at MAXLINE
+ *   characters.
+ */
+static void
+jointext(char **words, bool is_bg, char *text)
+{
+	size_t used = 0, n;
+	int j;
+
+	for (j = 0; words[j] != NULL && used < MAXLINE - 1; j++) {
+		if (j > 0)
+			text[used++] = ' ';
+		n = strlen(words[j]);
+		if (n > MAXLINE - 1 - used)
+			n = MAXLINE - 1 - used;
+		memcpy(&text[used], words[j], n);
+		used += n;
+	}
+	strcpy(&text[used], is_bg ? " &\n" : "\n");
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Waits until fewer than "max" jobs are running in the background and
+ *   the job table has a free slot.  Returns false if ctrl-c ended the
+ *   wait.
+ */
+static bool
+loop_slot(int max)
+{
+	sigset_t mask, prevmask, waitmask;
+	int i, nbg, nall;
+
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	waitmask = prevmask;
+	sigdelset(&waitmask, SIGCHLD);
+	sigint_pending = 0;
+	while (!sigint_pending) {
+		for (nbg = nall = 0, i = 0; i < MAXJOBS; i++) {
+			nall += jobs[i].pid != 0;
+			nbg += jobs[i].pid != 0 && jobs[i].state == BG;
+		}
+		if (nbg < max && nall < MAXJOBS)
+			break;
+		if (ncaptured > 0)
+			poll_events(-1, &waitmask);
+		else
+			sigsuspend(&waitmask);
+	}
+	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+	if (sigint_pending) {
+		sigint_pending = 0;
+		return (false);
+	}
+	return (true);
+}
+
+/*
+ * expand - Expand "$?" to the exit status of the last command, and
+ *  "$(cmd)" to the output of cmd.
+ *
+ * Requires:
+ *   "kind" is TOK_EXP_STATUS, or TOK_EXP_COMMAND and "text" holds the
+ *   "len" bytes of the command.
+ *
+ * Effects:
+ *   Appends the decimal value of laststatus, or the command's output, to
+ *   the word being tokenized.
+ */
+static bool
+expand(struct Tokens *t, int kind, const char *text, size_t len)
+{
+	char digits[16];
+	int n;
+
+	if (kind == TOK_EXP_COMMAND)
+		return (substitute(t, text, len));
+	n = snprintf(digits, sizeof(digits), "%d", laststatus);
+	return (tok_append(t, digits, n));
+}
+
+/*
+ * substitute - Run the command of a "$(cmd)" and collect its output.
+ *
+ * Requires:
+ *   "cmd" holds the "len" bytes between the parentheses.
+ *
+ * Effects:
+ *   Evaluates "cmd" in a forked copy of the shell whose stdout is a pipe,
+ *   and reads the pipe straight into the arena after the word being built,
+ *   where tokenize() splits it into words.  The copy runs the command's
+ *   last program in place of itself, as "tsh -c" does, so "$(prog)" costs
+ *   a single process, and a nested "$(...)" is expanded by the copy.
+ *   Passes ctrl-c on to the copy.  Returns false, after setting t->error,
+ *   if the output does not fit in the arena, which has MAXSUBST bytes to
+ *   spare.
+ */
+static bool
+substitute(struct Tokens *t, const char *cmd, size_t len)
+{
+	char text[MAXLINE + 1], *out = &t->arena[t->used], extra;
+	size_t room = tok_room(t), n = 0;
+	sigset_t mask, prevmask, waitmask;
+	struct pollfd pfd;
+	ssize_t nread;
+	bool overflow = false;
+	int fds[2], status;
+	pid_t pid;
+
+	snprintf(text, sizeof(text), "%.*s\n", (int)len, cmd);
+	if (pipe2(fds, O_CLOEXEC) < 0)
+		unix_error("pipe error");
+	// The shell reaps the copy itself; SIGINT comes in only in ppoll().
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigaddset(&mask, SIGINT);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	waitmask = prevmask;
+	Sigaddset(&waitmask, SIGCHLD);
+	// Flushes first, or the copy would write the shell's output again.
+	fflush(stdout);
+	if ((pid = Fork()) == 0) {
+		Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+		dup2(fds[1], STDOUT_FILENO);
+		subshell();
+		eval(text);
+		fflush(stdout);
+		exit(laststatus);
+	}
+	close(fds[1]);
+
+	// Reads a byte past a full arena to tell if there is more.
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	sigint_pending = 0;
+	while (true) {
+		if (ppoll(&pfd, 1, NULL, &waitmask) < 0) {
+			if (sigint_pending)
+				kill(pid, SIGINT);
+			sigint_pending = 0;
+			continue;
+		}
+		nread = n < room ? read(fds[0], &out[n], room - n) :
+		    read(fds[0], &extra, 1);
+		if (nread <= 0)
+			break;
+		if (n == room) {
+			overflow = true;
+			break;
+		}
+		n += nread;
+	}
+	// A copy that writes more dies of SIGPIPE.
+	close(fds[0]);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+	if (overflow) {
+		t->error = "command substitution output too long";
+		return (false);
+	}
+	t->used += n;
+	return (true);
+}
+
+/*
+ * subshell - Make a forked copy of the shell a shell of its own.
+ *
+ * Requires:
+ *   This is called in the child right after Fork().
+ *
+ * Effects:
+ *   Forgets the jobs, captured output, pool helpers and clients, which
+ *   all belong to the parent, and makes eval() run its line as for
+ *   "tsh -c".  Their descriptors are close-on-exec.
+ */
+static void
+subshell(void)
+{
+	int i;
+
+	initjobs(jobs);
+	nextjid = 1;
+	for (i = 0; i < MAXJOBS; i++)
+		captures[i].fd = -1;
+	ncaptured = 0;
+	npool = 0;
+	nnotes = 0;
+	recordfd = -1;
+	joblog_forget();
+	current = NULL;
+	for (i = 0; i < 3; i++)
+		serverfd[i] = i;
+	oneshot = true;
+}
+
+/* 
+ * eval_command - Evaluate a single command of a command line.
+ * 
+ * If the user has requested a built-in command (quit, jobs, bg or fg)
+ * then execute it immediately.  Otherwise, fork a child process and
+ * run the job in the context of the child.  If the job is running in
+ * the foreground, wait for it to terminate and then return.  Note:
+ * each child process must have a unique process group ID so that our
+ * background children don't receive SIGINT (SIGTSTP) from the kernel
+ * when we type ctrl-c (ctrl-z) at the keyboard.  
+ *
+ * Requires:
+ *   "argv" is a NULL-terminated argument list with at least one argument,
+ *   and "cmdline" is the newline-terminated text to show for the job.
+ *
+ * Effects:
+ *   Evaluates the command in argv; immediately executes built-in 
+ *   commands. Otherwise, runs its executable in child process (either
+ *   in the foreground or background).  Returns the command's exit status:
+ *   the builtin's status, the foreground job's status once it terminates
+ *   or stops, 0 for a background job, or 127 if the command was not found,
+ *   in which case no process is created.
+ */
+static int
+eval_command(char **argv, bool is_bg, const char *cmdline) 
+{
+	pid_t pid; 
+	int status = 0;
+	int dir = -1;
+	int cgfd = -1;
+	char cgname[32];
+
+	//Strips a "limit" prefix, keeping the limits for the job. 
+	struct Limits lim = deflimits;
+	bool limited = strcmp(argv[0], "limit") == 0;
+	if (limited && (argv = parselimits(&argv[1], &lim)) == NULL)
+		return (2);
+
+	//Runs builtins that need the shell's own state right here, which
+	//leaves no child to limit.
+	const struct Builtin *builtin = builtin_cmd(argv[0]);
+	if (builtin != NULL && (builtin->flags & BI_PARENT) != 0) {
+		if (limited) {
+			printf("limit: %s: cannot limit a shell builtin\n",
+			    argv[0]);
+			return (2);
+		}
+		return (run_builtin(builtin, argv));
+	}
+
+	//Looks the command up before forking, so a typo costs no process. 
+	if (builtin == NULL && !resolve(argv[0], &dir)) {
+		stats.execfail++;
+		printf("%s: Command not found.\n", argv[0]);
+		return (127);
+	}
+
+	//Holds a server client's line while there is no job slot for it,
+	//rather than failing the command; the server resumes it later.
+	if (current != NULL && jobsfull(jobs)) {
+		current->held = true;
+		return (laststatus);
+	}
+
+	//Runs the last command of "tsh -c" in place of the shell if no jobs
+	//are left for the shell to wait for, saving a fork.  Not with job
+	//logs, whose writer may still be waiting on a job's descendants.
+	if (lastcommand && builtin == NULL && !is_bg && !limited &&
+	    maxjid(jobs) == 0 && ncaptured == 0 && joblog_dir() == NULL)
+		exec_inplace(argv, dir);
+
+	//Child runs the job; blocks SIGCHLD to avoid race condition. 
+	sigset_t mask, prevmask;
+	Sigemptyset(&mask);
+	Sigemptyset(&prevmask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	//Routes a background job's output into a pipe the shell drains, or
+	//that the log writer drains into the job's log file.
+	int capfd[2] = { -1, -1 };
+	bool logged = is_bg && joblog_dir() != NULL;
+	if (is_bg && (opt_capture || logged) && pipe2(capfd, O_CLOEXEC) < 0)
+		unix_error("pipe error");
+	//Gives a limited job a cgroup of its own, if there is a delegated one. 
+	if (limited && (cgfd = cgroup_create(&lim, cgname,
+	    sizeof(cgname))) < 0) {
+		//Falls back to the nearest rlimits, unless some were given. 
+		if (lim.cpu >= 0)
+			printf("limit: cpu= needs a cgroup; ignored\n");
+		if (lim.mem >= 0 && lim.rlim[RL_AS] < 0)
+			lim.rlim[RL_AS] = lim.mem;
+		if (lim.pids >= 0 && lim.rlim[RL_NPROC] < 0)
+			lim.rlim[RL_NPROC] = lim.pids;
+	}
+	bool rlimited = false;
+	for (int i = 0; i < NRLIMITS; i++)
+		rlimited |= lim.rlim[i] >= 0;
+	//Flushes first so earlier output precedes the child's.
+	fflush(stdout);
+	fg_status = 0;
+	long long spawned = monotonic_ns();
+	//Hands the command to a pre-forked helper if there is one. 
+	pid = opt_pool && builtin == NULL && !limited && !rlimited ?
+	    pool_spawn(argv, dir, capfd[1]) : -1;
+	//Starts a limited job inside its cgroup, so it never runs outside. 
+	if (pid < 0)
+		pid = cgfd >= 0 ? clone_into(cgfd) : Fork();
+	//Child process runs the job. 
+	if (pid == 0) {
+		setpgid(0,0);
+		//Unblocks the child. 
+		Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+		if (rlimited)
+			apply_rlimits(&lim);
+		if (capfd[1] >= 0) {
+			dup2(capfd[1], STDOUT_FILENO);
+			dup2(capfd[1], STDERR_FILENO);
+		}
+		if (builtin != NULL) {
+			//Lets ctrl-c and ctrl-z act on the builtin as on a program.
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTSTP, SIG_DFL);
+			exit(builtin->handler(argv));
+		}
+		exec_command(argv, dir);
+	}
+	
+	int bg_fg = is_bg ? 2 : 1;
+	bool added = addjob(jobs, pid, bg_fg, cmdline);
+	if (added)
+		hist_add(&stats.spawn, monotonic_ns() - spawned);
+	if (limited) {
+		JobP job = getjobpid(jobs, pid);
+		if (job != NULL) {
+			job->cgfd = cgfd;
+			strcpy((char *)job->cgname, cgname);
+			job->rlimited = cgfd < 0;
+		} else if (cgfd >= 0) {
+			close(cgfd);
+			unlinkat(cgroot, cgname, AT_REMOVEDIR);
+		}
+	}
+	if (capfd[1] >= 0) {
+		close(capfd[1]);
+		if (added && logged)
+			joblog_add(capfd[0], pid2jid(pid), pid);
+		else if (added) {
+			struct Capture *cap = newcapture();
+			cap->jid = pid2jid(pid);
+			cap->pid = pid;
+			cap->fd = capfd[0];
+			cap->total = 0;
+			fcntl(cap->fd, F_SETFL, O_NONBLOCK);
+			ncaptured++;
+		} else
+			close(capfd[0]);
+	}
+	//Prints job information when running as background, before the job
+	//can be reaped and deleted. 
+	if (is_bg && added) {
+		JobP job = getjobpid(jobs, pid);
+		printf("[%u] (%u) %s", job->jid, job->pid, job->cmdline);
+	}
+	//Unblocks the child. 
+	Sigprocmask(SIG_UNBLOCK, &mask, &prevmask);
+	//Parent waits for fg job.
+	if (!is_bg) {
+		waitfg(pid);
+		status = fg_status;
+		if (added && current == NULL)
+			hist_add(&stats.fgjob, monotonic_ns() - spawned);
+	}
+	return (status);
+}
+
+/* 
+ * builtin_cmd - Look up a built-in command by name.
+ *
+ * Requires:
+ *   "name" is a properly terminated string.
+ *
+ * Effects:
+ *   Returns the entry of the builtin called "name", or NULL if there is
+ *   none.  Costs one hash and at most one string compare.
+ */
+static const struct Builtin *
+builtin_cmd(const char *name) 
+{
+	int i = builtin_slot[builtin_hash(name, BUILTIN_SEED) & BUILTIN_MASK];
+
+	if (i < 0 || strcmp(builtins[i].name, name) != 0)
+		return (NULL);  // This is not a built-in command. 
+	return (&builtins[i]);
+}
+
+/*
+ * run_builtin - Run a built-in command in the shell itself.
+ *
+ * Requires:
+ *   "argv" is a NULL-terminated argument list naming "builtin".
+ *
+ * Effects:
+ *   Runs the builtin's handler, with SIGCHLD blocked if the builtin uses the
+ *   job list, and returns its exit status.
+ */
+static int
+run_builtin(const struct Builtin *builtin, char **argv)
+{
+	sigset_t mask, prevmask;
+	int status;
+
+	if ((builtin->flags & BI_JOBLOCK) == 0)
+		return (builtin->handler(argv));
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	status = builtin->handler(argv);
+	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+	return (status);
+}
+
+/* 
+ * do_bgfg - Execute the built-in bg and fg commands.
+ *
+ * Requires:
+ *   argv[0] to be either "bg" or "fg".
+ *
+ * Effects:
+ *   Executes the command if argv indicates a valid process, else prints an
+ *   error statement.  Returns the command's exit status, which for fg is
+ *   the status of the job once it leaves the foreground.
+ */
+static int
+do_bgfg(char **argv) 
+{
+	//Checks if command is "bg" or "fg"
+	char *name = argv[0];
+	bool is_bg = strcmp(name, "bg") == 0;
+	//Checks to ensure there is a potential PID or JID. 
+	if (argv[1] == NULL) {
+		printf("%s command requires PID or %%jobid argument\n", name);
+		return (1);
+	}
+	//Gets the requested jid or pid. 
+	char *arg = argv[1];
+	/*Checks to ensure the first character is an integer, since 
+	atoi doesn't distinguish '0' and an error. */
+	if (arg[0] != '%' && !(arg[0] >= '0' && arg[0] <= '9')) {
+		printf("%s: argument must be a PID or %%jobid\n", name);
+		return (1);
+	}
+	//Catches accessing a job that doesn't exist. 
+	JobP job = getjobarg(jobs, arg);
+	if (job == NULL) {
+		if (arg[0] == '%')
+			printf("%s: No such job\n", arg);
+		else
+			printf("(%s): No such process\n", arg);
+		return (1);
+	}
+	//Changes state and sends SIGCONT; bg prints the job, fg waits. 
+	job->state = is_bg ? BG : FG;
+	record('J', job->jid, job->pid, is_bg ? "bg" : "fg", "");
+	if (is_bg)
+		printf("[%u] (%u) %s", job->jid, job->pid, job->cmdline);
+	Kill(job->pid, SIGCONT);
+	stats.forwarded[SIGCONT]++;
+	if (is_bg)
+		return (0);
+	waitfg(job->pid);
+	return (fg_status);
+}
+
+/*
+ * do_coproc - Execute the built-in coproc command.
+ *
+ * Requires:
+ *   argv[0] to be "coproc".
+ *
+ * Effects:
+ *   Starts the command argv[2] and its arguments as a background job
+ *   called argv[1], with its stdin and stdout connected to the shell
+ *   through a socket pair, for "write" and "read".  One long-lived process
+ *   can then answer many requests without a fork and exec for each.
+ *   Returns 127 if the command is not found, and 1 if the name is taken
+ *   by a coprocess that is still running.
+ */
+static int
+do_coproc(char **argv)
+{
+	struct Coproc *co;
+	char text[MAXLINE];
+	size_t len = 0;
+	sigset_t mask;
+	pid_t pid;
+	int i, dir, sv[2];
+
+	if (argv[1] == NULL || argv[2] == NULL) {
+		printf("coproc command requires a name and a command\n");
+		return (2);
+	}
+	if (strlen(argv[1]) >= sizeof(co->name)) {
+		printf("coproc: %s: Name too long\n", argv[1]);
+		return (2);
+	}
+	// The old coprocess of a name is forgotten once its job is gone.
+	if ((co = getcoproc(argv[1])) != NULL) {
+		if (getjobpid(jobs, co->pid) != NULL) {
+			printf("coproc: %s: Already running\n", argv[1]);
+			return (1);
+		}
+		close(co->fd);
+		co->name[0] = '\0';
+	}
+	for (i = 0; i < MAXJOBS && coprocs[i].name[0] != '\0'; i++)
+		;
+	if (i == MAXJOBS) {
+		printf("coproc: Too many coprocesses\n");
+		return (1);
+	}
+	co = &coprocs[i];
+	if (!resolve(argv[2], &dir)) {
+		printf("%s: Command not found.\n", argv[2]);
+		return (127);
+	}
+
+	// A socket pair carries both directions, and send() can avoid SIGPIPE.
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		unix_error("socketpair error");
+	fflush(stdout);
+	if ((pid = Fork()) == 0) {
+		setpgid(0, 0);
+		Sigemptyset(&mask);
+		Sigaddset(&mask, SIGCHLD);
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+		dup2(sv[1], STDIN_FILENO);
+		dup2(sv[1], STDOUT_FILENO);
+		apply_rlimits(&deflimits);
+		exec_command(&argv[2], dir);
+	}
+	close(sv[1]);
+	strcpy(co->name, argv[1]);
+	co->pid = pid;
+	co->fd = sv[0];
+
+	for (i = 0; argv[i] != NULL && len < sizeof(text) - 2; i++)
+		len += snprintf(&text[len], sizeof(text) - 1 - len, "%s%s",
+		    i > 0 ? " " : "", argv[i]);
+	strcpy(&text[len < sizeof(text) - 2 ? len : sizeof(text) - 2], "\n");
+	if (addjob(jobs, pid, BG, text)) {
+		JobP job = getjobpid(jobs, pid);
+		printf("[%u] (%u) %s", job->jid, job->pid, job->cmdline);
+	}
+	return (0);
+}
+
+/*
+ * do_exec - Execute the built-in exec command.
+ *
+ * Requires:
+ *   argv[0] to be "exec".
+ *
+ * Effects:
+ *   Replaces the shell with the command argv[1] and its arguments.  Jobs
+ *   that are still running are left to run on their own.  Returns 0 if
+ *   there is no command, and 127 if it is not found.
+ */
+static int
+do_exec(char **argv)
+{
+	int dir;
+
+	if (argv[1] == NULL)
+		return (0);
+	if (current != NULL) {
+		printf("%s: not available to server clients\n", argv[0]);
+		return (1);
+	}
+	if (!resolve(argv[1], &dir)) {
+		printf("%s: Command not found.\n", argv[1]);
+		return (127);
+	}
+	exec_inplace(&argv[1], dir);
+	return (126);	// Not reached.
+}
+
+/*
+ * do_help - Execute the built-in help command.
+ *
+ * Requires:
+ *   argv[0] to be "help".  argv[1], if present, names a builtin.
+ *
+ * Effects:
+ *   Prints the synopsis and description of the named builtin, or of every
+ *   builtin.  Returns 1 if there is no such builtin, and 0 otherwise.
+ */
+static int
+do_help(char **argv)
+{
+	const struct Builtin *builtin;
+	size_t i;
+
+	if (argv[1] != NULL) {
+		if ((builtin = builtin_cmd(argv[1])) == NULL) {
+			printf("help: no builtin named %s\n", argv[1]);
+			return (1);
+		}
+		printf("%-26s %s\n", builtin->usage, builtin->help);
+		return (0);
+	}
+	for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		printf("%-26s %s\n", builtins[i].usage, builtins[i].help);
+	return (0);
+}
+
+/*
+ * do_jobs - Execute the built-in jobs command.
+ *
+ * Requires:
+ *   argv[0] to be "jobs".  argv[1], if present, is "-l".
+ *
+ * Effects:
+ *   Lists the running and stopped jobs, with -l also the resource usage of
+ *   jobs started with limits, and returns 0.
+ */
+static int
+do_jobs(char **argv)
+{
+
+	if (argv[1] != NULL && strcmp(argv[1], "-l") != 0) {
+		printf("usage: jobs [-l]\n");
+		return (2);
+	}
+	listjobs(jobs, argv[1] != NULL);
+	return (0);
+}
+
+/*
+ * do_jstat - Execute the built-in jstat command.
+ *
+ * Requires:
+ *   argv[0] to be "jstat".  argv[1], if present, is a sampling interval in
+ *   seconds and argv[2], if present, is the number of samples to take.
+ *
+ * Effects:
+ *   Prints the state of every job's leader, and the number of processes,
+ *   threads, CPU usage, and resident set size of its process group.  With
+ *   an interval, keeps sampling until ctrl-c is typed, the sample count is
+ *   reached, or no jobs remain.  On a terminal each frame overwrites the
+ *   previous one.  Each frame is written with one write(), or queued for
+ *   a server's client, which cannot use an interval.  /proc is only
+ *   scanned for the members of the groups when jstat starts and after a
+ *   member with children exits; otherwise each frame rereads the open
+ *   descriptors of the leaders and the members that it follows, at most
+ *   MAXMEMBERS of them.
+ */
+static int
+do_jstat(char **argv)
+{
+	static char frame[MAXJOBS * (MAXLINE + 64) + 128];
+	struct Members members[MAXJOBS];
+	char line[MAXLINE + 64];
+	long interval = 0, count = 0;
+	int i, nsamples, nlines, prevlines = 0;
+	bool tty = isatty(STDOUT_FILENO);
+	sigset_t mask, prevmask;
+	size_t len;
+
+	// Parses the optional interval and count.
+	for (i = 1; i <= 2 && argv[i] != NULL; i++) {
+		char *end;
+		long val = strtol(argv[i], &end, 10);
+		if (*end != '\0' || val <= 0) {
+			printf("%s: interval and count must be positive "
+			    "integers\n", argv[0]);
+			return (1);
+		}
+		if (i == 1)
+			interval = val;
+		else
+			count = val;
+	}
+	// A server cannot sleep between frames without blocking.
+	if (current != NULL && interval > 0) {
+		printf("%s: interval not available to server clients\n",
+		    argv[0]);
+		return (1);
+	}
+
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	sigint_pending = 0;
+	fflush(stdout);
+	for (nsamples = 1; ; nsamples++) {
+		/*
+		 * Blocks SIGCHLD so that deletejob() cannot close a job's
+		 * descriptors while they are being read.
+		 */
+		Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+		long long now = monotonic_ns();
+		len = 0;
+		if (tty && prevlines > 0) {
+			// Moves the cursor back over the previous frame.
+			len += snprintf(&frame[len], sizeof(frame) - len,
+			    "\033[%dA\033[J", prevlines);
+		}
+		len += snprintf(&frame[len], sizeof(frame) - len,
+		    "JID      PID     PGID S PROCS  THR   CPU%%    RSS(KB) "
+		    "COMMAND\n");
+		nlines = 1;
+		// Members whose parent exited can only be found in /proc.
+		if (nsamples == 1)
+			jstat_scan();
+		if (jstat_members(members)) {
+			jstat_scan();
+			jstat_members(members);
+		}
+		for (i = 0; i < MAXJOBS; i++) {
+			if (jobs[i].pid == 0 || !jstat_sample(&jobs[i],
+			    &members[i], now, line, sizeof(line)))
+				continue;
+			len += snprintf(&frame[len], sizeof(frame) - len,
+			    "%s", line);
+			nlines++;
+		}
+		Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+		// A client's frame is queued with the rest of its output.
+		if (current != NULL)
+			fwrite(frame, 1, len, stdout);
+		else if (write(STDOUT_FILENO, frame, len) < 0)
+			unix_error("write error");
+		prevlines = nlines;
+
+		if (interval == 0 || nlines == 1 ||
+		    (count > 0 && nsamples >= count))
+			break;
+		if (!tty) {
+			// Separates the frames when they cannot be redrawn.
+			if (write(STDOUT_FILENO, "\n", 1) < 0)
+				unix_error("write error");
+		}
+
+		// Sleeps for the interval, resuming after SIGCHLD.
+		struct timespec req = { .tv_sec = interval, .tv_nsec = 0 };
+		while (nanosleep(&req, &req) < 0 && errno == EINTR &&
+		    !sigint_pending)
+			;
+		if (sigint_pending)
+			break;
+	}
+	jstat_forget();
+	sigint_pending = 0;
+	return (0);
+}
+
+/*
+ * do_kill - Execute the built-in kill, stop, and cont commands.
+ *
+ * Requires:
+ *   argv[0] to be "kill", "stop", or "cont".
+ *
+ * Effects:
+ *   Signals each job named by a PID or %jobid argument, or every job for
+ *   %all, in one pass over the job table that signals each job's process
+ *   group once, however many arguments name it.  "--running" and
+ *   "--stopped" skip the jobs in the other state and, without job
+ *   arguments, select every job in theirs.  kill sends SIGTERM unless
+ *   given -SIG, a signal name or number; stop sends SIGSTOP and cont
+ *   SIGCONT.  Stopped jobs that are continued are marked as running in
+ *   the background right away, and are also continued after SIGTERM or
+ *   SIGHUP, as by other shells, so that those take effect.  A PID that is
+ *   no job's is signalled as /bin/kill would, but a PID must be positive
+ *   and must not be the shell's own process group.  Returns 1 if an
+ *   argument names no job or process, 2 for a bad argument, and 0
+ *   otherwise.
+ */
+static int
+do_kill(char **argv)
+{
+	bool found[MAXARGS] = { false }, all = false, picked;
+	char **args;
+	int sig, state = UNDEF, status = 0, i, j;
+
+	if (strcmp(argv[0], "cont") == 0)
+		sig = SIGCONT;
+	else if (strcmp(argv[0], "stop") == 0)
+		sig = SIGSTOP;
+	else
+		sig = SIGTERM;
+	for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "--running") == 0)
+			state = BG;
+		else if (strcmp(argv[i], "--stopped") == 0)
+			state = ST;
+		else if (strcmp(argv[0], "kill") == 0 &&
+		    parsesig(&argv[i][1]) >= 0)
+			sig = parsesig(&argv[i][1]);
+		else {
+			printf("%s: %s: Invalid signal or option\n", argv[0],
+			    argv[i]);
+			return (2);
+		}
+	}
+	args = &argv[i];
+	if (args[0] == NULL && state == UNDEF) {
+		printf("%s command requires PID or %%jobid argument\n",
+		    argv[0]);
+		return (2);
+	}
+	for (i = 0; args[i] != NULL; i++) {
+		if (strcmp(args[i], "%all") == 0 ||
+		    strcmp(args[i], "%%all") == 0)
+			all = found[i] = true;
+		else if (!((args[i][0] == '%' && atoi(&args[i][1]) > 0) ||
+		    parsepid(args[i]) > 0)) {
+			printf("%s: argument must be a PID or %%jobid\n",
+			    argv[0]);
+			return (2);
+		} else if (parsepid(args[i]) == getpgrp()) {
+			// Signalling the group would reach the shell itself.
+			printf("%s: %s: the shell's own process group\n",
+			    argv[0], args[i]);
+			return (2);
+		}
+	}
+	if (args[0] == NULL)
+		all = true;
+
+	for (j = 0; j < MAXJOBS; j++) {
+		JobP job = &jobs[j];
+		if (job->pid == 0)
+			continue;
+		for (picked = all, i = 0; args[i] != NULL; i++) {
+			if (args[i][0] == '%' ? atoi(&args[i][1]) == job->jid :
+			    parsepid(args[i]) == job->pid)
+				picked = found[i] = true;
+		}
+		if (!picked || (state == ST && job->state != ST) ||
+		    (state == BG && job->state == ST))
+			continue;
+		// The child may not have made its process group yet.
+		if (kill(-job->pid, sig) < 0)
+			kill(job->pid, sig);
+		stats.forwarded[sig]++;
+		// A stopped job would only act on SIGTERM or SIGHUP once resumed.
+		if ((sig == SIGTERM || sig == SIGHUP) && job->state == ST &&
+		    kill(-job->pid, SIGCONT) < 0)
+			kill(job->pid, SIGCONT);
+		if (sig == SIGCONT && job->state == ST) {
+			job->state = BG;
+			record('J', job->jid, job->pid, "bg", "");
+		}
+	}
+
+	for (i = 0; args[i] != NULL; i++) {
+		if (found[i])
+			continue;
+		if (args[i][0] == '%') {
+			printf("%s: No such job\n", args[i]);
+			status = 1;
+		} else if (kill(parsepid(args[i]), sig) < 0) {
+			printf("(%s): No such process\n", args[i]);
+			status = 1;
+		}
+	}
+	return (status);
+}
+
+/*
+ * do_notify - Execute the built-in notify command.
+ *
+ * Requires:
+ *   argv[0] to be "notify".
+ *
+ * Effects:
+ *   Prints the job status changes that are being held back for the next
+ *   prompt, as with the notify option off, right away.
+ */
+static int
+do_notify(char **argv)
+{
+
+	(void)argv;
+	print_notes();
+	return (0);
+}
+
+/*
+ * do_output - Execute the built-in output command.
+ *
+ * Requires:
+ *   argv[0] to be "output".
+ *
+ * Effects:
+ *   With no argument, lists every captured job and how much of its output
+ *   was kept.  With a PID or %jobid, prints the job's buffered output.
+ *   With "-f", then keeps printing the job's output as it arrives until
+ *   the job closes its output or ctrl-c is typed.
+ */
+static int
+do_output(char **argv)
+{
+	struct Capture *cap;
+	bool follow = false;
+	char *arg = argv[1];
+	int i;
+
+	if (arg == NULL) {
+		for (i = 0; i < MAXJOBS; i++) {
+			cap = &captures[i];
+			if (cap->jid == 0)
+				continue;
+			printf("[%d] (%d) %s %llu bytes, %llu dropped\n",
+			    cap->jid, (int)cap->pid,
+			    cap->fd >= 0 ? "Open" : "Closed", cap->total,
+			    cap->total > OUTBUFSIZE ? cap->total - OUTBUFSIZE :
+			    0);
+		}
+		return (0);
+	}
+	if (strcmp(arg, "-f") == 0) {
+		follow = true;
+		if ((arg = argv[2]) == NULL) {
+			printf("%s: -f requires PID or %%jobid argument\n",
+			    argv[0]);
+			return (1);
+		}
+	}
+	if ((cap = getcapture(arg)) == NULL) {
+		printf("%s: No captured output\n", arg);
+		return (1);
+	}
+	print_capture(cap, 0);
+	if (!follow)
+		return (0);
+
+	// Blocks SIGCHLD and SIGINT so that neither is missed before ppoll().
+	sigset_t mask, prevmask;
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigaddset(&mask, SIGINT);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	sigint_pending = 0;
+	while (cap->fd >= 0 && !sigint_pending) {
+		unsigned long long from = cap->total;
+		poll_events(-1, &prevmask);
+		print_capture(cap, from);
+	}
+	sigint_pending = 0;
+	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+	return (0);
+}
+
+/*
+ * do_prlimit - Execute the built-in prlimit command.
+ *
+ * Requires:
+ *   argv[0] to be "prlimit".
+ *
+ * Effects:
+ *   Sets the rlimits given as "name=N" arguments on the running job argv[1],
+ *   a PID or %jobid, with prlimit(), or lists the job's rlimits if none
+ *   are given.  Only the job's own process is changed; processes it has
+ *   already forked keep their limits.
+ */
+static int
+do_prlimit(char **argv)
+{
+	long long rlim[NRLIMITS] = { -1, -1, -1, -1, -1 };
+	struct rlimit rl;
+	JobP job;
+	int i;
+
+	if (argv[1] == NULL) {
+		printf("usage: prlimit <job> [name=N ...]\n");
+		return (2);
+	}
+	if ((job = getjobarg(jobs, argv[1])) == NULL) {
+		printf("%s: No such job\n", argv[1]);
+		return (1);
+	}
+	for (i = 2; argv[i] != NULL; i++) {
+		if (!parserlimit(argv[i], rlim)) {
+			printf("prlimit: bad limit %s\n", argv[i]);
+			return (2);
+		}
+	}
+	for (i = 0; i < NRLIMITS; i++) {
+		if (argv[2] == NULL) {
+			if (prlimit(job->pid, rlimits[i].resource, NULL, &rl) < 0)
+				break;
+			print_rlimit(rlimits[i].name, rl.rlim_cur);
+			continue;
+		}
+		if (rlim[i] < 0)
+			continue;
+		rl.rlim_cur = rl.rlim_max = rlim[i] == LLONG_MAX ?
+		    RLIM_INFINITY : (rlim_t)rlim[i];
+		if (prlimit(job->pid, rlimits[i].resource, &rl, NULL) < 0)
+			break;
+	}
+	if (i < NRLIMITS) {
+		printf("prlimit: %s: %s\n", rlimits[i].name, strerror(errno));
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * do_quit - Execute the built-in quit command.
+ *
+ * Requires:
+ *   argv[0] to be "quit".
+ *
+ * Effects:
+ *   Terminates the shell.
+ */
+static int
+do_quit(char **argv)
+{
+
+	(void)argv;
+	// Only ends the session of a server's client.
+	if (current != NULL) {
+		current->quit = true;
+		return (0);
+	}
+	exit(0);
+}
+
+/*
+ * do_read - Execute the built-in read command.
+ *
+ * Requires:
+ *   argv[0] to be "read".
+ *
+ * Effects:
+ *   Prints the next line of output of the coprocess argv[1], waiting for
+ *   it until ctrl-c.  The line is peeked at and then only it is taken from
+ *   the socket, so the shell keeps no buffer of its own and a forked copy
+ *   of the shell, as in "$(read name)", reads from the same place.  At the
+ *   end of the output, which stays readable after the job is gone, forgets
+ *   the coprocess.  Returns 0 after a line, 1 at the end of the output, and
+ *   130 on ctrl-c.
+ */
+static int
+do_read(char **argv)
+{
+	struct Coproc *co;
+	struct pollfd pfd;
+	char buf[4096], *nl;
+	bool partial = false;
+	ssize_t n;
+
+	if (argv[1] == NULL) {
+		printf("read command requires a coprocess name\n");
+		return (2);
+	}
+	if ((co = getcoproc(argv[1])) == NULL) {
+		printf("read: %s: No such coprocess\n", argv[1]);
+		return (1);
+	}
+	pfd.fd = co->fd;
+	pfd.events = POLLIN;
+	sigint_pending = 0;
+	while (true) {
+		n = recv(co->fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			// poll() is never restarted, so ctrl-c ends it.
+			if (poll(&pfd, 1, -1) < 0 && sigint_pending) {
+				sigint_pending = 0;
+				return (130);
+			}
+			continue;
+		}
+		if (n <= 0) {
+			close(co->fd);
+			co->name[0] = '\0';
+			return (partial ? 0 : 1);
+		}
+		if ((nl = memchr(buf, '\n', n)) != NULL)
+			n = nl - buf + 1;
+		if ((n = recv(co->fd, buf, n, 0)) > 0)
+			fwrite(buf, 1, n, stdout);
+		if (nl != NULL)
+			return (0);
+		partial = true;
+	}
+}
+
+/*
+ * do_set - Execute the built-in set command.
+ *
+ * Requires:
+ *   argv[0] to be "set".
+ *
+ * Effects:
+ *   With no argument, lists the shell options.  "set -o name" enables the
+ *   named option and "set +o name" disables it.
+ */
+static int
+do_set(char **argv)
+{
+	int status, i;
+
+	if (argv[1] == NULL) {
+		for (i = 0; options[i].name != NULL; i++)
+			printf("set %co %s\n", *options[i].flag ? '-' : '+',
+			    options[i].name);
+		if (joblog_dir() != NULL)
+			printf("set -o log=%s\n", joblog_dir());
+		else
+			printf("set +o log\n");
+		printf("set -o logsize=%lld\n", joblog_size());
+		printf("set -o logkeep=%d\n", joblog_keep());
+		return (0);
+	}
+	if ((strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0) ||
+	    argv[2] == NULL) {
+		printf("%s: usage: set [-o|+o option]\n", argv[0]);
+		return (1);
+	}
+	if ((status = setoption(argv[2], argv[1][0] == '-')) < 0) {
+		printf("%s: %s: No such option\n", argv[0], argv[2]);
+		return (1);
+	}
+	return (status);
+}
+
+/*
+ * do_source - Execute the built-in source command.
+ *
+ * Requires:
+ *   argv[0] to be "source".
+ *
+ * Effects:
+ *   Reads and evaluates every line of the file argv[1], as if it had been
+ *   typed, and then resumes reading the previous input.  Returns the exit
+ *   status of the last command in the file.
+ */
+static int
+do_source(char **argv)
+{
+	static int depth = 0;          // number of files being sourced
+	struct Input *prev = input;
+	char cmdline[MAXLINE];
+
+	if (argv[1] == NULL) {
+		printf("%s: filename argument required\n", argv[0]);
+		return (1);
+	}
+	// A server cannot wait for the file's jobs without blocking.
+	if (current != NULL) {
+		printf("%s: not available to server clients\n", argv[0]);
+		return (1);
+	}
+	if (depth == MAXSOURCE) {
+		printf("%s: %s: too many nested files\n", argv[0], argv[1]);
+		return (1);
+	}
+	struct Input *file = Malloc(sizeof(*file));
+	if ((file->fd = open(argv[1], O_RDONLY | O_CLOEXEC)) < 0) {
+		printf("%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		free(file);
+		return (1);
+	}
+	file->pos = file->len = 0;
+	file->eof = false;
+
+	depth++;
+	input = file;
+	laststatus = 0;
+	while (readcmd(cmdline, MAXLINE))
+		eval(cmdline);
+	input = prev;
+	depth--;
+
+	close(file->fd);
+	free(file);
+	return (laststatus);
+}
+
+/*
+ * do_stats - Execute the built-in stats command.
+ *
+ * Requires:
+ *   argv[0] to be "stats".
+ *
+ * Effects:
+ *   Prints the shell's counters and latency histograms, or only those
+ *   named, as one line of JSON with -j.
+ */
+static int
+do_stats(char **argv)
+{
+	static const char *const names[] = { "spawned", "exec_failures",
+	    "reaped", "too_many_jobs", "jobs_high_water", "forwarded",
+	    "spawn_us", "fg_job_us", "waitfg_us" };
+	char buf[8192];
+	bool json = argv[1] != NULL && strcmp(argv[1], "-j") == 0;
+	size_t i, j;
+
+	for (i = json ? 2 : 1; argv[i] != NULL; i++) {
+		for (j = 0; j < sizeof(names) / sizeof(names[0]); j++)
+			if (strcmp(argv[i], names[j]) == 0)
+				break;
+		if (j == sizeof(names) / sizeof(names[0])) {
+			printf("%s: %s: No such stat\n", argv[0], argv[i]);
+			return (2);
 		}
 	}
-	//Returns while true loop.
-	return;
+	fwrite(buf, 1, format_stats(buf, sizeof(buf), json,
+	    &argv[json ? 2 : 1]), stdout);
+	return (0);
 }
 
-/* 
- * parseline - Parse the command line and build the argv array.
+/*
+ * do_ulimit - Execute the built-in ulimit command.
  *
  * Requires:
- *   "cmdline" is a NUL ('\0') terminated string with a trailing
- *   '\n' character.  "cmdline" must contain less than MAXARGS
- *   arguments.
+ *   argv[0] to be "ulimit".
  *
  * Effects:
- *   Builds "argv" array from space delimited arguments on the command line.
- *   The final element of "argv" is set to NULL.  Characters enclosed in
- *   single quotes are treated as a single argument.  Returns true if
- *   the user has requested a BG job and false if the user has requested
- *   a FG job.
- *
- * Note:
- *   In the textbook, this function has the return type "int", but "bool"
- *   is more appropriate.
+ *   Sets the rlimits given as "name=N" arguments as the defaults for every
+ *   job started from now on, after forgetting the previous defaults if -r
+ *   comes first.  The shell itself is not limited.  With no argument,
+ *   lists the limits a new job gets.
  */
-static bool
-parseline(const char *cmdline, char **argv) 
-{
-	int argc;                   // number of args
-	static char array[MAXLINE]; // local copy of command line
-	char *buf = array;          // ptr that traverses command line
-	char *delim;                // points to first space delimiter
-	bool bg;                    // background job?
-
-	strcpy(buf, cmdline);
-
-	// Replace trailing '\n' with space.
-	buf[strlen(buf) - 1] = ' ';
-
-	// Ignore leading spaces.
-	while (*buf != '\0' && *buf == ' ')
-		buf++;
-
-	// Build the argv list.
-	argc = 0;
-	if (*buf == '\'') {
-		buf++;
-		delim = strchr(buf, '\'');
-	} else
-		delim = strchr(buf, ' ');
-	while (delim != NULL) {
-		argv[argc++] = buf;
-		*delim = '\0';
-		buf = delim + 1;
-		while (*buf != '\0' && *buf == ' ')	// Ignore spaces.
-			buf++;
-		if (*buf == '\'') {
-			buf++;
-			delim = strchr(buf, '\'');
-		} else
-			delim = strchr(buf, ' ');
-	}
-	argv[argc] = NULL;
-
-	// Ignore blank line.
-	if (argc == 0)
-		return (true);
-
-	// Should the job run in the background?
-	if ((bg = (*argv[argc - 1] == '&')) != 0)
-		argv[--argc] = NULL;
+static int
+do_ulimit(char **argv)
+{
+	struct Limits lim = deflimits;
+	struct rlimit rl;
+	int i = 1;
 
-	return (bg);
+	if (argv[1] == NULL) {
+		for (i = 0; i < NRLIMITS; i++) {
+			if (lim.rlim[i] >= 0)
+				rl.rlim_cur = lim.rlim[i] == LLONG_MAX ?
+				    RLIM_INFINITY : (rlim_t)lim.rlim[i];
+			else if (getrlimit(rlimits[i].resource, &rl) < 0)
+				unix_error("getrlimit error");
+			print_rlimit(rlimits[i].name, rl.rlim_cur);
+		}
+		return (0);
+	}
+	if (strcmp(argv[1], "-r") == 0) {
+		for (i = 0; i < NRLIMITS; i++)
+			lim.rlim[i] = -1;
+		i = 2;
+	}
+	for (; argv[i] != NULL; i++) {
+		if (!parserlimit(argv[i], lim.rlim)) {
+			printf("ulimit: bad limit %s\n", argv[i]);
+			printf("usage: ulimit [-r] [name=N ...]\n");
+			return (2);
+		}
+	}
+	deflimits = lim;
+	return (0);
 }
 
-/* 
- * builtin_cmd - If the user has typed a built-in command then execute
- *  it immediately.  
+/*
+ * do_wait - Execute the built-in wait command.
  *
  * Requires:
- *   'argv' is a parsed commandline.  
+ *   argv[0] to be "wait".
  *
  * Effects:
- *   Executes the command if argv[0] is a built in command, returning true. 
- *   Returns false otherwise. 
- *
- * Note:
- *   In the textbook, this function has the return type "int", but "bool"
- *   is more appropriate.
+ *   Waits until the job argv[1], a PID or %jobid, or else every background
+ *   job, is no longer running, or until ctrl-c is typed.  A server's client
+ *   only waits for its own jobs.  Returns 130 after ctrl-c, 127 if there is
+ *   no such job, and 0 otherwise.
  */
-static bool
-builtin_cmd(char **argv) 
+static int
+do_wait(char **argv)
 {
-	char *name = argv[0];
+	sigset_t waitmask;
+	pid_t pid = -1;
+	JobP job;
 
-	if (strcmp(name, "quit") == 0) { // quit case	
-		exit(0);
+	if (argv[1] != NULL) {
+		if ((job = getjobarg(jobs, argv[1])) == NULL) {
+			printf("%s: No such job\n", argv[1]);
+			return (127);
+		}
+		pid = job->pid;
 	}
-	if (strcmp(name, "bg") == 0 || strcmp(name, "fg") == 0) { // bg or fg case
-		do_bgfg(argv);
-		return (true);
+	if (current != NULL) {
+		current->waiting = pid;
+		current->waitfg = false;
+		return (0);
 	}
-	if (strcmp(name, "jobs") == 0) { // jobs case
-		listjobs(jobs);
-		return (true);
+	// Lets SIGCHLD, blocked as the job lock, in while waiting.
+	Sigprocmask(SIG_BLOCK, NULL, &waitmask);
+	sigdelset(&waitmask, SIGCHLD);
+	sigint_pending = 0;
+	while (running(pid, -1) && !sigint_pending) {
+		if (ncaptured > 0)
+			poll_events(-1, &waitmask);
+		else
+			sigsuspend(&waitmask);
 	}
-	return (false);     // This is not a built-in command. 
+	if (sigint_pending) {
+		sigint_pending = 0;
+		return (130);
+	}
+	return (0);
 }
 
-/* 
- * do_bgfg - Execute the built-in bg and fg commands.
+/*
+ * do_write - Execute the built-in write command.
  *
  * Requires:
- *   argv[0] to be either "bg" or "fg".
+ *   argv[0] to be "write".
  *
  * Effects:
- *   Executes the command if argv indicates a valid process, else prints an
- *   error statement.
+ *   Sends the rest of the arguments, separated by spaces and ended with a
+ *   newline, to the stdin of the coprocess argv[1].  Returns 1 if there is
+ *   no such coprocess or it no longer reads its input.
  */
-static void
-do_bgfg(char **argv) 
+static int
+do_write(char **argv)
 {
-	//Checks if command is "bg" or "fg"
-	char *name = argv[0];
-	bool is_bg = strcmp(name, "bg") == 0;
-	//Checks to ensure there is a potential PID or JID. 
+	static char line[2 * MAXLINE + MAXSUBST];
+	struct Coproc *co;
+	size_t len = 0, off;
+	ssize_t n;
+	int i;
+
 	if (argv[1] == NULL) {
-		printf("%s", "bg command requires PID or %%jobid argument\n");
-		return;
+		printf("write command requires a coprocess name\n");
+		return (2);
 	}
-	//Gets the requested jid or pid. 
-	char *arg = argv[1];
-	//Runs the checks and actions for the background job. 
-	if (is_bg) { 
-		if (arg[0] == '%') { // by job (jid)
-			// Cuts off the leading '%'.   
-			char *jidstr = &arg[1];
-			int jid = atoi(jidstr);
-			//Catches an error with the string provided.  
-			if (jid == 0) { 
-				printf("%s: No such job\n", arg);
-				return;
-			}
-			//Catches accessing a job that doesn't exist. 
-			JobP job = getjobjid(jobs, jid);
-			if (job == NULL) {
-				printf("%s: No such job\n", arg);
-				return;
-			}
-			//Changes state, prints, and sends SIGCONT. 
-			job->state = BG;
-			printf("[%u] (%u) %s", job->jid, job->pid, job->cmdline);
-			Kill(job->pid, SIGCONT);
-		} else { // by process (pid)
-			/*Checks to ensure the first character is an integer, since 
-			atoi doesn't distinguish '0' and an error. */
-			if (!(arg[0] >= '0' && arg[0] <= '9')) {
-				printf("%s%s", name, ": argument must be a PID or %jobid\n");
-				return;
-			}
-			//Gets the pid of the requested job. 
-			int pid = atoi(arg);
-			//Catches accessing a job that doesn't exist.
-			JobP job = getjobpid(jobs, (pid_t)pid);
-			if (job == NULL) {
-				printf("(%u): No such process\n", pid);
-				return;
-			}
-			//Changes state, prints, and sends SIGCONT.
-			job->state = BG;
-			printf("[%u] (%u) %s\n", job->jid, job->pid, job->cmdline);
-			Kill(job->pid, SIGCONT);
-		}
-	//Runs the checks and actions for the foreground job. 
-	} else { 
-		if (arg[0] == '%') { // by job (jid)
-			// Cuts off the leading '%'. 
-			char *jidstr = &arg[1];
-			int jid = atoi(jidstr);
-			//Catches an error with the string provided.  
-			if (jid == 0) {
-				printf("(%s): No such job", arg);
-				return;
-			}
-			//Catches accessing a job that doesn't exist.
-			JobP job = getjobjid(jobs, jid);
-			if (job == NULL) {
-				printf("(%s): No such job", arg);
-				return;
-			}
-			//Changes state, sends SIGCONT, and waits. 
-			job->state = FG;
-			Kill(job->pid, SIGCONT);
-			waitfg(job->pid);
-
-		} else { // by process (pid)
-			/*Checks to ensure the first character is an integer, since 
-			atoi doesn't distinguish '0' and an error. */
-			if (!(arg[0] >= '0' && arg[0] <= '9')) {
-				printf("%s%s", name, ": argument must be a PID or %jobid\n");
-				return;
-			}
-			//Gets the pid of the requested job. 
-			int pid = atoi(arg);
-			//Catches accessing a job that doesn't exist.
-			JobP job = getjobpid(jobs, (pid_t)pid);
-			if (job == NULL) {
-				printf("(%u): No such process", pid);
-				return;
+	if ((co = getcoproc(argv[1])) == NULL) {
+		printf("write: %s: No such coprocess\n", argv[1]);
+		return (1);
+	}
+	// The words came from one arena of the same size, so they fit.
+	for (i = 2; argv[i] != NULL; i++) {
+		if (i > 2)
+			line[len++] = ' ';
+		len = stpcpy(&line[len], argv[i]) - line;
+	}
+	line[len++] = '\n';
+	for (off = 0; off < len; off += n) {
+		if ((n = send(co->fd, &line[off], len - off,
+		    MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
 			}
-			//Changes state, sends SIGCONT, and waits. 
-			job->state = FG;
-			Kill(job->pid, SIGCONT);
-			waitfg(job->pid);
+			printf("write: %s: %s\n", argv[1], strerror(errno));
+			return (1);
 		}
 	}
+	return (0);
 }
 
 /* 
@@ -754,10 +4402,29 @@ waitfg(pid_t pid)
 	Sigemptyset(&prevmask);
 	Sigaddset(&mask, SIGCHLD);
 	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	// Lets SIGCHLD in while waiting, even if the caller has it blocked.
+	sigset_t waitmask = prevmask;
+	sigdelset(&waitmask, SIGCHLD);
+	/*
+	 * A server goes back to its other clients instead, and resumes the
+	 * client's line once the job is done.
+	 */
+	if (current != NULL) {
+		current->waiting = pid;
+		current->waitfg = true;
+		Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+		return;
+	}
 	// Waits until SIGCHLD signal updates pid to not be in the foreground
+	long long suspended = monotonic_ns();
 	while ((fgpid(jobs) == pid)) {
-		sigsuspend(&prevmask);
+		// Keeps draining captured output while the job runs.
+		if (ncaptured > 0)
+			poll_events(-1, &waitmask);
+		else
+			sigsuspend(&waitmask);
 	}
+	hist_add(&stats.waitfg, monotonic_ns() - suspended);
 	// Unblocks SIGCHILD. 
 	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
 }
@@ -767,49 +4434,70 @@ waitfg(pid_t pid)
  *  which may be simply saving the path.
  *
  * Requires:
- *   "pathstr" is a valid search path.
+ *   "pathstr" is a valid search path or NULL.
  *
  * Effects:
- *   Updates 'paths' to contain every valid search path. 
+ *   Splits "pathstr" in one pass into 'paths', each entry ending in '/' and
+ *   an empty entry becoming "/", which stands for the current directory.
+ *   'paths', 'pathfds', and the strings share one allocation.  The
+ *   directories themselves are opened by pathfd() as lookups reach them.
  */
 static void
 initpath(const char *pathstr)
 {
-	if (pathstr != NULL) {
-	
-		// Counts the number of paths.
-		int colon_count = 0;
-		for (unsigned int i = 0; i < strlen(pathstr); i++) {
-			if (pathstr[i] == ':') {
-				colon_count++;
-			}
-		}
-		// Malloc space for paths. 
-		paths = Malloc(sizeof(char *) * (colon_count + 2));
-		
-		//Separates the pathstring into seperate paths. 
-		int begIdx = 0;
-		int curr_pathIdx = 0;
-		for (unsigned int i = 0; i < strlen(pathstr); i++) {
-			if (pathstr[i] == ':') {
-				//Calls helper function to generate each path. 
-				paths[curr_pathIdx] = get_path((char *)pathstr, begIdx, i);
-				curr_pathIdx++;
-				begIdx = i + 1;
-			}
-			
-		}
-		//Adds the final path. 
-		paths[curr_pathIdx] = get_path((char *)pathstr, begIdx, strlen(pathstr));
-		//Verbose check for correct paths. 
-		if (verbose) {
-			for (int j = 0; j <= curr_pathIdx; j++) {
-				printf("From init: %s\n", paths[j]);
-			}
-		}
-		//Null-terminates the paths array. 
-		paths[curr_pathIdx + 1] = NULL;
-	} 
+	long long start = timing ? monotonic_ns() : 0;
+	const char *p;
+	char *str;
+	int n = 1, i;
+
+	if (pathstr == NULL)
+		return;
+	for (p = pathstr; (p = strchr(p, ':')) != NULL; p++)
+		n++;
+	// Each entry loses its ':' and gains a '/' and a NUL.
+	paths = Malloc((n + 1) * sizeof(char *) + n * sizeof(int) +
+	    strlen(pathstr) + 2 * n);
+	pathfds = (int *)&paths[n + 1];
+	str = (char *)&pathfds[n];
+	for (i = 0, p = pathstr; i < n; i++) {
+		paths[i] = str;
+		pathfds[i] = -2;
+		while (*p != ':' && *p != '\0')
+			*str++ = *p++;
+		*str++ = '/';
+		*str++ = '\0';
+		p++;
+		if (verbose)
+			printf("From init: %s\n", paths[i]);
+	}
+	paths[n] = NULL;
+	if (timing)
+		printf("startup: path %lld us (%d directories)\n",
+		    (monotonic_ns() - start) / 1000, n);
+}
+
+/*
+ * Requires:
+ *   'paths' has an entry "i".
+ *
+ * Effects:
+ *   Returns an O_PATH descriptor of the directory paths[i], opening it the
+ *   first time, so that commands can be looked up relative to it without
+ *   rebuilding the full path.  Returns AT_FDCWD for "/", which stands for
+ *   the current directory, and -1 if the directory cannot be opened.
+ */
+static int
+pathfd(int i)
+{
+
+	if (pathfds[i] == -2) {
+		if (strcmp(paths[i], "/") == 0)
+			pathfds[i] = AT_FDCWD;
+		else
+			pathfds[i] = open(paths[i],
+			    O_PATH | O_DIRECTORY | O_CLOEXEC);
+	}
+	return (pathfds[i]);
 }
 
 /*
@@ -835,44 +4523,77 @@ sigchld_handler(int signum)
 {
 	int status, sig; 
 	pid_t pid;	
+	int olderrno = errno;
+	record('S', -1, 0, "CHLD", "");
 	//Reaps all children possible. 
 	while ((pid = waitpid(-1, &status, WNOHANG|WUNTRACED)) > 0) {
+		JobP job = getjobpid(jobs, pid);
+		//Reports on a server client's job to that client. 
+		note_client = job != NULL ? job->client : -1;
+		sio_fd = serverfd[1];
+		//Records the exit status of the foreground job for $?.
+		if (job != NULL && job->state == FG) {
+			if (WIFEXITED(status))
+				fg_status = WEXITSTATUS(status);
+			else if (WIFSIGNALED(status))
+				fg_status = 128 + WTERMSIG(status);
+			else if (WIFSTOPPED(status))
+				fg_status = 128 + WSTOPSIG(status);
+			//Hands it to the server if a client waits for it. 
+			for (int i = 0; job->client >= 0 && i < MAXJOBS; i++) {
+				if (fgdone[i].pid == 0) {
+					fgdone[i].status = fg_status;
+					fgdone[i].pid = pid;
+					break;
+				}
+			}
+		}
 		if (WIFEXITED(status)) { //child terminated normally
+			//Reports every reap, so that lost reaps can be found.
+			char code[16];
+			sio_ltoa(WEXITSTATUS(status), code, 10);
+			record('J', pid2jid(pid), pid, "exited ", code);
+			stats.reaped++;
+			// exec_command() exits with 126 if execve() fails.
+			if (WEXITSTATUS(status) == 126)
+				stats.execfail++;
+			if (verbose)
+				note_job(pid2jid(pid), pid, "exited with status ",
+				    code);
 			// Removes the child from jobs.
 			deletejob(jobs, pid);
 		}
 		
 		if (WIFSIGNALED(status)) { //child was terminated due to a signal
 			sig = WTERMSIG(status);
+			//Looks up the job ID before the job is removed.
+			int childjobid = pid2jid(pid); 
 			//Removes the child from jobs. 
 			deletejob(jobs, pid);
-			//Prints the terminated child message.
-			long childjobid = (long)pid2jid(pid); 
-			Sio_puts("Job [");
-			Sio_putl(childjobid);
-			Sio_puts("] (");
-			Sio_putl((long)pid);
-			Sio_puts(") terminated by signal SIG");
-			Sio_puts(signame[sig]);
-			Sio_puts("\n");
+			//Reports the terminated child.
+			record('J', childjobid, pid, "terminated SIG", signame[sig]);
+			stats.reaped++;
+			note_job(childjobid, pid, "terminated by signal SIG",
+			    signame[sig]);
 		}
 		if (WIFSTOPPED(status)) { // child was suspended
 			sig = WSTOPSIG(status);
 			//Changes the job status to stopped. 
-			JobP job = getjobpid(jobs, pid);
-			job->state = ST;
-			//Prints the stopped child message.
-			long childjobid = (long)pid2jid(pid); 
-			Sio_puts("Job [");
-			Sio_putl(childjobid);
-			Sio_puts("] (");
-			Sio_putl((long)pid);
-			Sio_puts(") stopped by signal SIG");
-			Sio_puts(signame[sig]);
-			Sio_puts("\n");
+			if (job != NULL)
+				job->state = ST;
+			//Reports the stopped child.
+			record('J', pid2jid(pid), pid, "stopped SIG", signame[sig]);
+			note_job(pid2jid(pid), pid, "stopped by signal SIG",
+			    signame[sig]);
 		}
 		
 	}
+	note_client = -1;
+	sio_fd = STDOUT_FILENO;
+	//Writes this round's reports at once, unless they wait for a prompt.
+	if (opt_notify)
+		flush_notes();
+	errno = olderrno;
 	// Prevents an "unused parameter" warning.
 	(void)signum;
 }
@@ -893,10 +4614,15 @@ sigint_handler(int signum)
 {
 	// Prevents an "unused parameter" warning.
 	(void)signum;
+	record('S', -1, 0, "INT", "");
 	pid_t pid = fgpid(jobs);
 	// Sends SIGINT to all processes in foreground process group. 
 	if (pid != 0) {
 		Kill(-pid, SIGINT);	
+		stats.forwarded[SIGINT]++;
+	} else {
+		// Lets an interruptible builtin notice the ctrl-c.
+		sigint_pending = 1;
 	}
 }
 
@@ -916,11 +4642,348 @@ sigtstp_handler(int signum)
 {
 	// Prevent an "unused parameter" warning.
 	(void)signum;
+	record('S', -1, 0, "TSTP", "");
 	pid_t pid = fgpid(jobs);
 	// Sends SIGTSTP to all processes in foreground process group. 
 	if (pid != 0) {
 		Kill(-pid, SIGTSTP);
+		stats.forwarded[SIGTSTP]++;
+	}
+}
+
+/*
+ * sigusr1_handler - With the statsdump option set, the shell prints its
+ *  stats to stderr whenever it receives SIGUSR1.  setoption() installs
+ *  it only while the option is set, so that SIGUSR1 otherwise keeps its
+ *  default action.
+ *
+ * Requires:
+ *   "signum" is SIGUSR1.
+ *
+ * Effects:
+ *   Writes the stats as text.
+ */
+static void
+sigusr1_handler(int signum)
+{
+	char buf[8192];
+	int olderrno = errno;
+
+	// Prevent an "unused parameter" warning.
+	(void)signum;
+	write(STDERR_FILENO, buf, format_stats(buf, sizeof(buf), false,
+	    NULL));
+	errno = olderrno;
+}
+
+/*
+ * Requires:
+ *   "what" and "detail" are properly terminated strings.
+ *
+ * Effects:
+ *   Adds "Job [jid] (pid) <what><detail>" to the job notifications, or,
+ *   for a server's client, to those that the server queues for it, unless
+ *   they are full, in which case it goes to the server's stdout.  Sends
+ *   the notifications first if there is no room for it.  This function
+ *   can be safely called by a signal handler.
+ */
+static void
+note_job(int jid, pid_t pid, const char *what, const char *detail)
+{
+	const char *parts[] = { "Job [", NULL, "] (", NULL, ") ", what,
+	    detail, "\n" };
+	char line[128], jidstr[16], pidstr[16];
+	size_t len = 0, n, i;
+
+	sio_ltoa(jid, jidstr, 10);
+	sio_ltoa(pid, pidstr, 10);
+	parts[1] = jidstr;
+	parts[3] = pidstr;
+	for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+		n = sio_strlen(parts[i]);
+		if (n > sizeof(line) - len)
+			n = sizeof(line) - len;
+		memcpy(&line[len], parts[i], n);
+		len += n;
+	}
+	if (note_client >= 0 && len + 3 <= sizeof(clientnotes) -
+	    nclientnotes) {
+		clientnotes[nclientnotes] = note_client >> 8;
+		clientnotes[nclientnotes + 1] = note_client & 0xff;
+		clientnotes[nclientnotes + 2] = len;
+		memcpy(&clientnotes[nclientnotes + 3], line, len);
+		nclientnotes += len + 3;
+		return;
+	}
+	if (sio_fd != STDOUT_FILENO) {
+		write(sio_fd, line, len);
+		return;
 	}
+	if (len > sizeof(notes) - nnotes)
+		flush_notes();
+	memcpy(&notes[nnotes], line, len);
+	nnotes += len;
+}
+
+/*
+ * Requires:
+ *   SIGCHLD is blocked, or this is called by sigchld_handler().
+ *
+ * Effects:
+ *   Writes the job notifications to stdout with one write and empties
+ *   them.  This function can be safely called by a signal handler.
+ */
+static void
+flush_notes(void)
+{
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < nnotes; off += n)
+		if ((n = write(STDOUT_FILENO, &notes[off], nnotes - off)) <= 0)
+			break;
+	nnotes = 0;
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Flushes stdout and then writes the job notifications that are being
+ *   held back, so that they follow the output that came before them.
+ */
+static void
+print_notes(void)
+{
+	sigset_t mask, prevmask;
+
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigprocmask(SIG_BLOCK, &mask, &prevmask);
+	fflush(stdout);
+	flush_notes();
+	Sigprocmask(SIG_SETMASK, &prevmask, NULL);
+}
+
+/*
+ * Requires:
+ *   "what" and "detail" are properly terminated strings.
+ *
+ * Effects:
+ *   With --record, appends a "<usec> <type> <jid> <pid> <what><detail>"
+ *   event to the recording, leaving out the job if "jid" is negative and
+ *   "detail" from its first newline on.  Each event takes one write, so
+ *   those of the signal handlers never split another.  This function can
+ *   be safely called by a signal handler.
+ */
+static void
+record(char type, int jid, pid_t pid, const char *what, const char *detail)
+{
+	char line[4 * MAXLINE + 64], usec[24], jidstr[16], pidstr[16];
+	char typestr[] = { ' ', type, '\0' };
+	const char *parts[] = { usec, typestr, jid < 0 ? "" : " ", jidstr,
+	    jid < 0 ? "" : " ", pidstr, *what != '\0' ? " " : "", what,
+	    detail };
+	size_t len = 0, i, j;
+	int olderrno = errno;
+
+	if (recordfd < 0)
+		return;
+	sio_ltoa((monotonic_ns() - recordstart) / 1000, usec, 10);
+	sio_ltoa(jid, jidstr, 10);
+	sio_ltoa(pid, pidstr, 10);
+	if (jid < 0)
+		jidstr[0] = pidstr[0] = '\0';
+	for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+		for (j = 0; parts[i][j] != '\0' && parts[i][j] != '\n' &&
+		    len < sizeof(line) - 1; j++)
+			line[len++] = parts[i][j];
+	line[len++] = '\n';
+	write(recordfd, line, len);
+	errno = olderrno;
+}
+
+/*
+ * Requires:
+ *   "line" is a properly terminated string.
+ *
+ * Effects:
+ *   Records an input line as a "type" event, escaping backslashes,
+ *   newlines, and other control bytes so that tshreplay gets back the
+ *   same bytes.
+ */
+static void
+record_line(char type, const char *line)
+{
+	char text[4 * MAXLINE];
+	size_t len = 0;
+
+	if (recordfd < 0)
+		return;
+	for (; *line != '\0' && len < sizeof(text) - 5; line++) {
+		if (*line == '\\')
+			len += sprintf(&text[len], "\\\\");
+		else if (*line == '\n')
+			len += sprintf(&text[len], "\\n");
+		else if ((unsigned char)*line < ' ' || *line == 0x7f)
+			len += sprintf(&text[len], "\\x%02x",
+			    (unsigned char)*line);
+		else
+			text[len++] = *line;
+	}
+	text[len] = '\0';
+	record(type, -1, 0, text, "");
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Adds a sample of "ns" nanoseconds to the histogram.  This function can
+ *   be safely called by a signal handler.
+ */
+static void
+hist_add(volatile struct Histogram *h, long long ns)
+{
+	unsigned long long usec = ns > 0 ? ns / 1000 : 0;
+	int i = usec == 0 ? 0 : 64 - __builtin_clzll(usec);
+
+	h->bucket[i < NBUCKETS ? i : NBUCKETS - 1]++;
+	h->count++;
+	h->sum += usec;
+}
+
+/*
+ * Requires:
+ *   "buf" has room for "size" characters.
+ *
+ * Effects:
+ *   Formats the stats into "buf", as text or as a single line of JSON, and
+ *   returns the length, cutting the text short if it does not fit.  Only
+ *   the stats named in "names" are included, unless it is NULL or empty.
+ *   Signals and histogram buckets that never counted anything are left
+ *   out.  This function can be safely called by a signal handler.
+ */
+static size_t
+format_stats(char *buf, size_t size, bool json, char **names)
+{
+	static const struct {
+		const char *name;
+		volatile unsigned long *count;
+	} counters[] = {
+		{ "spawned", &stats.spawned },
+		{ "exec_failures", &stats.execfail },
+		{ "reaped", &stats.reaped },
+		{ "too_many_jobs", &stats.toomany },
+		{ "jobs_high_water", &stats.highwater },
+	};
+	static const struct {
+		const char *name;
+		volatile struct Histogram *h;
+	} hists[] = {
+		{ "spawn_us", &stats.spawn },
+		{ "fg_job_us", &stats.fgjob },
+		{ "waitfg_us", &stats.waitfg },
+	};
+	char nums[3][24];
+	size_t len = 0, i, j, k, n;
+	bool first, comma = false;
+
+// Appends each of its strings to buf.
+#define EMIT(...) do {							\
+	const char *list[] = { __VA_ARGS__ };				\
+	for (n = 0; n < sizeof(list) / sizeof(list[0]); n++)		\
+		for (k = 0; list[n][k] != '\0' && len < size; k++)	\
+			buf[len++] = list[n][k];			\
+} while (0)
+
+	EMIT(json ? "{" : "");
+	for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+		if (!wanted(names, counters[i].name))
+			continue;
+		sio_ltoa(*counters[i].count, nums[0], 10);
+		if (json)
+			EMIT(comma ? "," : "", "\"", counters[i].name, "\":",
+			    nums[0]);
+		else
+			EMIT(counters[i].name, " ", nums[0], "\n");
+		comma = true;
+	}
+	if (wanted(names, "forwarded")) {
+		EMIT(json && comma ? "," : "", json ? "\"forwarded\":{" :
+		    "forwarded");
+		comma = true;
+	}
+	for (i = 1, first = true; i < NSIG && wanted(names, "forwarded");
+	    i++) {
+		if (stats.forwarded[i] == 0)
+			continue;
+		sio_ltoa(stats.forwarded[i], nums[0], 10);
+		if (json)
+			EMIT(first ? "" : ",", "\"", signame[i], "\":", nums[0]);
+		else
+			EMIT(" ", signame[i], "=", nums[0]);
+		first = false;
+	}
+	if (wanted(names, "forwarded"))
+		EMIT(json ? "}" : "\n");
+	for (i = 0; i < sizeof(hists) / sizeof(hists[0]); i++) {
+		volatile struct Histogram *h = hists[i].h;
+		if (!wanted(names, hists[i].name))
+			continue;
+		sio_ltoa(h->count, nums[0], 10);
+		sio_ltoa(h->sum, nums[1], 10);
+		sio_ltoa(h->count > 0 ? h->sum / h->count : 0, nums[2], 10);
+		if (json)
+			EMIT(comma ? "," : "", "\"", hists[i].name,
+			    "\":{\"count\":", nums[0], ",\"sum\":", nums[1],
+			    ",\"buckets\":[");
+		else
+			EMIT(hists[i].name, " count ", nums[0], " mean ",
+			    nums[2], "\n");
+		for (j = 0, first = true; j < NBUCKETS; j++) {
+			if (h->bucket[j] == 0)
+				continue;
+			// The bucket's lower bound, in microseconds.
+			sio_ltoa(j == 0 ? 0 : 1L << (j - 1), nums[0], 10);
+			sio_ltoa(h->bucket[j], nums[1], 10);
+			if (json)
+				EMIT(first ? "" : ",", "[", nums[0], ",",
+				    nums[1], "]");
+			else
+				EMIT("  >= ", nums[0], " us ", nums[1], "\n");
+			first = false;
+		}
+		EMIT(json ? "]}" : "");
+		comma = true;
+	}
+	EMIT(json ? "}\n" : "");
+#undef EMIT
+	return (len);
+}
+
+/*
+ * Requires:
+ *   "names" is NULL or a NULL-terminated array of strings, and "name" is a
+ *   properly terminated string.
+ *
+ * Effects:
+ *   Returns whether "name" is in "names", or true if "names" is NULL or
+ *   empty.  This function can be safely called by a signal handler.
+ */
+static bool
+wanted(char **names, const char *name)
+{
+	size_t i;
+
+	if (names == NULL || names[0] == NULL)
+		return (true);
+	for (i = 0; names[i] != NULL; i++)
+		if (strcmp(names[i], name) == 0)
+			return (true);
+	return (false);
 }
 
 /*
@@ -939,10 +5002,26 @@ sigquit_handler(int signum)
 
 	// Prevent an "unused parameter" warning.
 	(void)signum;
+	record('S', -1, 0, "QUIT", "");
 	Sio_puts("Terminating after receipt of SIGQUIT signal\n");
 	_exit(1);
 }
 
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Ignores SIGPIPE, so that a server survives writing to a client that is
+ *   gone.  Unlike SIG_IGN, a handler is not inherited by the jobs.
+ */
+static void 
+sigpipe_handler(int signum) 
+{
+
+	(void)signum;
+}
+
 /*
  * This comment marks the end of the signal handlers.
  */
@@ -966,6 +5045,15 @@ clearjob(JobP job)
 	job->jid = 0;
 	job->state = UNDEF;
 	job->cmdline[0] = '\0';
+	job->statfd = -1;
+	job->statmfd = -1;
+	job->childfd = -1;
+	job->cputicks = 0;
+	job->sampled = 0;
+	job->cgfd = -1;
+	job->cgname[0] = '\0';
+	job->rlimited = false;
+	job->client = -1;
 }
 
 /*
@@ -1002,6 +5090,25 @@ maxjid(JobP jobs)
 	return (max);
 }
 
+/*
+ * Requires:
+ *   "jobs" points to an array of MAXJOBS job structures.
+ *
+ * Effects:
+ *   Returns true if every slot of the jobs list is in use, so that addjob()
+ *   would fail.
+ */
+static bool
+jobsfull(JobP jobs)
+{
+	int i;
+
+	for (i = 0; i < MAXJOBS; i++)
+		if (jobs[i].pid == 0)
+			return (false);
+	return (true);
+}
+
 /*
  * Requires:
  *   "jobs" points to an array of MAXJOBS job structures, and "cmdline" is
@@ -1014,7 +5121,8 @@ maxjid(JobP jobs)
 static bool
 addjob(JobP jobs, pid_t pid, int state, const char *cmdline)
 {
-	int i;
+	unsigned long n;
+	int i, j;
     
 	if (pid < 1)
 		return (false);
@@ -1025,8 +5133,17 @@ addjob(JobP jobs, pid_t pid, int state, const char *cmdline)
 			jobs[i].jid = nextjid++;
 			if (nextjid > MAXJOBS)
 				nextjid = 1;
+			jobs[i].client = current != NULL ?
+			    (int)(current - clients) : -1;
 			// Remove the "volatile" qualifier using a cast.
 			strcpy((char *)jobs[i].cmdline, cmdline);
+			record('J', jobs[i].jid, pid, state == FG ? "fg " : "bg ",
+			    cmdline);
+			stats.spawned++;
+			for (n = 0, j = 0; j < MAXJOBS; j++)
+				n += jobs[j].pid != 0;
+			if (n > stats.highwater)
+				stats.highwater = n;
 			if (verbose) {
 				printf("Added job [%d] %d %s\n", jobs[i].jid,
 				    (int)jobs[i].pid, jobs[i].cmdline);
@@ -1034,6 +5151,7 @@ addjob(JobP jobs, pid_t pid, int state, const char *cmdline)
 			return (true);
 		}
 	}
+	stats.toomany++;
 	printf("Tried to create too many jobs\n");
 	return (false);
 }
@@ -1055,6 +5173,22 @@ deletejob(JobP jobs, pid_t pid)
 		return (false);
 	for (i = 0; i < MAXJOBS; i++) {
 		if (jobs[i].pid == pid) {
+			// close() is async-signal-safe, so this is fine here.
+			if (jobs[i].statfd >= 0)
+				close(jobs[i].statfd);
+			if (jobs[i].statmfd >= 0)
+				close(jobs[i].statmfd);
+			if (jobs[i].childfd >= 0)
+				close(jobs[i].childfd);
+			/*
+			 * unlinkat() is async-signal-safe too.  The cgroup
+			 * stays if grandchildren of the job still run in it.
+			 */
+			if (jobs[i].cgfd >= 0) {
+				close(jobs[i].cgfd);
+				unlinkat(cgroot, (const char *)jobs[i].cgname,
+				    AT_REMOVEDIR);
+			}
 			clearjob(&jobs[i]);
 			nextjid = maxjid(jobs) + 1;
 			return (true);
@@ -1124,6 +5258,26 @@ getjobjid(JobP jobs, int jid)
 	return (NULL);
 }
 
+/*
+ * Requires:
+ *   "jobs" points to an array of MAXJOBS job structures, and "arg" is a
+ *   properly terminated string.
+ *
+ * Effects:
+ *   Returns a pointer to the job named by "arg", which is either a PID or
+ *   a %jobid, or NULL if there is no such job.
+ */
+static JobP
+getjobarg(JobP jobs, const char *arg)
+{
+
+	if (arg[0] == '%')
+		return (getjobjid(jobs, atoi(&arg[1])));
+	if (!(arg[0] >= '0' && arg[0] <= '9'))
+		return (NULL);
+	return (getjobpid(jobs, (pid_t)atoi(arg)));
+}
+
 /*
  * Requires:
  *   Nothing.
@@ -1150,10 +5304,11 @@ pid2jid(pid_t pid)
  *   "jobs" points to an array of MAXJOBS job structures.
  *
  * Effects:
- *   Prints the jobs list.
+ *   Prints the jobs list, followed for each job by its resource usage if
+ *   "usage" is true.
  */
 static void
-listjobs(JobP jobs) 
+listjobs(JobP jobs, bool usage) 
 {
 	int i;
 
@@ -1175,6 +5330,8 @@ listjobs(JobP jobs)
 				    "job[%d].state=%d ", i, jobs[i].state);
 			}
 			printf("%s", jobs[i].cmdline);
+			if (usage)
+				print_usage(&jobs[i]);
 		}
 	}
 }
@@ -1198,10 +5355,22 @@ static void
 usage(void) 
 {
 
-	printf("Usage: shell [-hvp]\n");
+	printf("Usage: shell [-hvpT] [-o option] [--record file] "
+	    "[-c command | script | --serve socket]\n");
 	printf("   -h   print this message\n");
 	printf("   -v   print additional diagnostic information\n");
 	printf("   -p   do not emit a command prompt\n");
+	printf("   -T   report where startup time goes\n");
+	printf("   -o   enable the named shell option (see \"set\"), or "
+	    "log=DIR to log\n        background jobs' output to DIR\n");
+	printf("   -c   run the command line and exit, executing its last\n"
+	    "        command in place of the shell when nothing is left to "
+	    "wait for\n");
+	printf("   --serve  own the jobs of the clients (tshc) that connect "
+	    "to socket\n");
+	printf("   --record  log input, signals, and job changes to file, "
+	    "for tshreplay\n");
+	printf("   script  read commands from this file instead of stdin\n");
 	exit(1);
 }
 
@@ -1326,7 +5495,7 @@ static ssize_t
 sio_puts(const char s[])
 {
 
-	return (write(STDOUT_FILENO, s, sio_strlen(s)));
+	return (write(sio_fd, s, sio_strlen(s)));
 }
 
 /*
@@ -1399,7 +5568,7 @@ Sio_error(const char s[])
 }
 
 // Prevent "unused function" and "unused variable" warnings.
-static const void *dummy_ref[] = { Sio_error, Sio_putl, addjob, builtin_cmd,
-    deletejob, do_bgfg, dummy_ref, fgpid, getjobjid, getjobpid, listjobs,
-    parseline, pid2jid, signame, waitfg};
+static const void *dummy_ref[] = { Sio_error, Sio_putl, addjob, app_error,
+    builtin_cmd, deletejob, do_bgfg, dummy_ref, fgpid, getjobjid, getjobpid,
+    listjobs, pid2jid, signame, waitfg};
 
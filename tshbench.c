@@ -0,0 +1,828 @@
+/*
+ * tshbench.c - Benchmarks for the tiny shell.
+ *
+ * usage: tshbench [-s shell] <benchmark> [n]
+ *
+ * Runs the named benchmark against the shell (./tsh by default) and
+ * prints one line per measurement.  The benchmarks are:
+ *
+ *   coproc   Makes n requests of /bin/cat, first starting it for each
+ *            one and then writing to and reading from one coprocess, and
+ *            reports the time per request.
+ *   script   Runs an n-line script of builtin commands, both as a script
+ *            file argument and on stdin, and reports lines/sec.
+ *   spawn    Types n commands one at a time, waiting for each one's output,
+ *            and reports the mean prompt-to-exec latency with plain fork
+ *            and with the pre-forked helper pool.
+ *   parse    Tokenizes a long command line n times with each instruction
+ *            set the CPU supports and reports MB/s.  Runs in-process; the
+ *            shell is not used.
+ *   serve    Connects n clients at once to one "tsh --serve" and has them
+ *            all send a builtin and then an external command, and reports
+ *            lines/sec.
+ *   startup  Starts the shell n times and reports the time from fork to
+ *            its first prompt: the mean, median, and 99th percentile.
+ *   stress   Launches n short-lived background jobs as fast as the job
+ *            table allows while sending INT, TSTP, and CONT to the jobs
+ *            and the shell.  Checks that every job is reaped exactly once
+ *            and that the job table ends empty, and reports reaps/sec.
+ *            Exits with status 1 if a check fails.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parse.h"
+#include "serve.h"
+
+// The jobs that the stress benchmark keeps alive at once.  tsh's job table
+// holds 16, and the driver's view of it lags behind the shell's.
+#define STRESSJOBS 12
+
+// What the stress benchmark has seen of a child of the shell.
+struct Child {
+	pid_t pid;              // 0 if the slot is free
+	int launched;           // times the shell reported starting it
+	int reaped;             // times the shell reported reaping it
+	bool stopped;           // stopped and not yet sent SIGCONT
+};
+
+static const char *shell = "./tsh";	// shell under test
+
+static void	bench_coproc(long n);
+static void	bench_parse(long n);
+static void	bench_script(long n);
+static void	bench_serve(long n);
+static void	bench_spawn(long n);
+static void	bench_startup(long n);
+static void	bench_stress(long n);
+static struct Child *	child(struct Child *children, size_t size,
+		    pid_t pid);
+static double	interact(char **argv, long n);
+static int	cmpdouble(const void *a, const void *b);
+static double	now(void);
+static double	run(char **argv, int infd);
+static char *	tmpscript(void);
+static void	unix_error(const char *msg);
+static void	usage(void);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Runs the benchmark named on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	long n = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "hs:")) != -1) {
+		switch (c) {
+		case 's':             // Use a different shell.
+			shell = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc)
+		usage();
+	if (optind + 1 < argc && (n = atol(argv[optind + 1])) <= 0)
+		usage();
+
+	if (strcmp(argv[optind], "coproc") == 0)
+		bench_coproc(n > 0 ? n : 2000);
+	else if (strcmp(argv[optind], "script") == 0)
+		bench_script(n > 0 ? n : 100000);
+	else if (strcmp(argv[optind], "spawn") == 0)
+		bench_spawn(n > 0 ? n : 1000);
+	else if (strcmp(argv[optind], "parse") == 0)
+		bench_parse(n > 0 ? n : 2000);
+	else if (strcmp(argv[optind], "serve") == 0)
+		bench_serve(n > 0 ? n : 500);
+	else if (strcmp(argv[optind], "startup") == 0)
+		bench_startup(n > 0 ? n : 2000);
+	else if (strcmp(argv[optind], "stress") == 0)
+		bench_stress(n > 0 ? n : 5000);
+	else
+		usage();
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Times two scripts that each make "n" requests of /bin/cat: one runs
+ *   "/bin/cat /dev/null" per request, the least that starting a helper for
+ *   each command costs, and one writes each request to a single /bin/cat
+ *   coprocess and reads the reply back.
+ */
+static void
+bench_coproc(long n)
+{
+	char *path = tmpscript();
+	FILE *fp;
+	double secs;
+	long i;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		unix_error("fopen error");
+	for (i = 0; i < n; i++)
+		fputs("/bin/cat /dev/null\n", fp);
+	if (fclose(fp) != 0)
+		unix_error("fclose error");
+	char *argv[] = { (char *)shell, path, NULL };
+	secs = run(argv, -1);
+	printf("coproc: %ld requests, a process each: %.1f usec/request\n",
+	    n, secs * 1e6 / n);
+
+	if ((fp = fopen(path, "w")) == NULL)
+		unix_error("fopen error");
+	fputs("coproc cat /bin/cat\n", fp);
+	for (i = 0; i < n; i++)
+		fputs("write cat request\nread cat\n", fp);
+	if (fclose(fp) != 0)
+		unix_error("fclose error");
+	secs = run(argv, -1);
+	printf("coproc: %ld requests to one coprocess: %.1f usec/request\n",
+	    n, secs * 1e6 / n);
+
+	unlink(path);
+	free(path);
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Builds a 64 KB command line of mostly long words, with some quoting and
+ *   operators mixed in, and times tokenizing all of it "n" times with each
+ *   instruction set.  This is the tokenizer's throughput on its own, with
+ *   none of the shell's other per-line costs.
+ */
+static void
+bench_parse(long n)
+{
+	static const char *const names[] = { "scalar", "sse2", "avx2" };
+	static const char *const words[] = {
+		"/usr/local/bin/some-long-program-name ",
+		"--option=value ",
+		"'a single-quoted argument' ",
+		"\"double $? quoted\" ",
+		"escaped\\ space ",
+		"&& ",
+	};
+	static char line[65536], arena[sizeof(line)];
+	static char *argv[sizeof(line) / 2];
+	struct Tokens t = { .words = argv, .maxwords = sizeof(argv) /
+	    sizeof(argv[0]), .arena = arena, .size = sizeof(arena) };
+	size_t len = 0, pos, w;
+	double secs;
+	long i, ntok;
+	int isa;
+
+	for (i = 0; len + 64 < sizeof(line); i++) {
+		w = strlen(words[i % 6]);
+		memcpy(&line[len], words[i % 6], w);
+		len += w;
+	}
+	line[len++] = '\n';
+
+	for (isa = TOK_ISA_SCALAR; isa <= tok_isa(); isa++) {
+		tok_set_isa(isa);
+		ntok = 0;
+		secs = now();
+		for (i = 0; i < n; i++) {
+			pos = 0;
+			while (tokenize(line, len, &pos, &t) > TOK_END)
+				ntok += t.nwords;
+		}
+		secs = now() - secs;
+		printf("parse: %s: %ld x %zu bytes, %ld words, %.0f MB/s\n",
+		    names[isa], n, len, ntok / n, n * len / secs / 1e6);
+	}
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Writes an n-line script of builtin commands and times the shell
+ *   running it as a script file and reading it from stdin.  Builtins keep
+ *   fork and exec out of the measurement, so this is the per-line cost of
+ *   reading, parsing, and dispatching.
+ */
+static void
+bench_script(long n)
+{
+	static const char *const lines[] = {
+		"jobs\n",
+		"set +o capture\n",
+		"jobs && jobs || jobs\n",
+		"# a comment\n",
+	};
+	char *path = tmpscript();
+	FILE *fp;
+	double secs;
+	long i;
+	int fd;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		unix_error("fopen error");
+	for (i = 0; i < n; i++)
+		fputs(lines[i % (sizeof(lines) / sizeof(lines[0]))], fp);
+	if (fclose(fp) != 0)
+		unix_error("fclose error");
+
+	char *fileargv[] = { (char *)shell, path, NULL };
+	secs = run(fileargv, -1);
+	printf("script: %ld lines from a file in %.3f s (%.0f lines/sec)\n",
+	    n, secs, n / secs);
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		unix_error("open error");
+	char *stdinargv[] = { (char *)shell, "-p", NULL };
+	secs = run(stdinargv, fd);
+	printf("script: %ld lines from stdin in %.3f s (%.0f lines/sec)\n",
+	    n, secs, n / secs);
+	close(fd);
+
+	unlink(path);
+	free(path);
+}
+
+/*
+ * Requires:
+ *   "n" is positive and below the open file limit.
+ *
+ * Effects:
+ *   Starts the shell as a server, connects "n" clients to it at once, and
+ *   has every client send a line at the same time, first a builtin and
+ *   then an external command, waiting for all of the replies.  Reports the
+ *   lines/sec that one server process sustains.  Exits with status 1 if a
+ *   client gets no reply.
+ */
+static void
+bench_serve(long n)
+{
+	static const char *const lines[] = { "jobs", "/bin/true" };
+	char path[] = "/tmp/tshbench.sock.XXXXXX", buf[64];
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct pollfd *fds;
+	const char *payload;
+	size_t plen;
+	double start;
+	int null, nfds, pfds[3], type, status;
+	long i, left;
+	size_t l;
+	pid_t pid;
+
+	if (mkdtemp(path) == NULL)
+		unix_error("mkdtemp error");
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/sock", path);
+	if ((null = open("/dev/null", O_RDWR)) < 0)
+		unix_error("open error");
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid == 0) {
+		if (dup2(null, STDIN_FILENO) < 0 ||
+		    dup2(null, STDOUT_FILENO) < 0)
+			unix_error("dup2 error");
+		execl(shell, shell, "--serve", addr.sun_path, (char *)NULL);
+		unix_error(shell);
+	}
+	if ((fds = calloc(n, sizeof(*fds))) == NULL)
+		unix_error("calloc error");
+	pfds[0] = pfds[1] = pfds[2] = null;
+	for (i = 0; i < n; i++) {
+		if ((fds[i].fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			unix_error("socket error");
+		while (connect(fds[i].fd, (struct sockaddr *)&addr,
+		    sizeof(addr)) < 0) {
+			if (errno != ENOENT && errno != ECONNREFUSED)
+				unix_error("connect error");
+			usleep(1000);
+		}
+		if (!srv_send(fds[i].fd, SRV_HELLO, NULL, 0, pfds, 3))
+			unix_error("send error");
+		fds[i].events = POLLIN;
+	}
+	for (l = 0; l < sizeof(lines) / sizeof(lines[0]); l++) {
+		start = now();
+		for (i = 0; i < n; i++)
+			if (!srv_send(fds[i].fd, SRV_CMD, lines[l],
+			    strlen(lines[l]), NULL, 0))
+				unix_error("send error");
+		// Every reply is one small frame, read whole.
+		for (left = n; left > 0; ) {
+			if (poll(fds, n, 5000) <= 0) {
+				printf("serve: %ld of %ld clients got no reply "
+				    "to %s\n", left, n, lines[l]);
+				exit(1);
+			}
+			for (i = 0; i < n; i++) {
+				if ((fds[i].revents & POLLIN) == 0)
+					continue;
+				if (srv_recv(fds[i].fd, buf, sizeof(buf), pfds,
+				    0, &nfds) <= 0 || srv_frame(buf,
+				    sizeof(buf), &type, &payload, &plen) <= 0 ||
+				    type != SRV_DONE)
+					unix_error("bad reply");
+				left--;
+			}
+		}
+		printf("serve: %ld clients at once, %s: %.0f lines/sec\n", n,
+		    lines[l], n / (now() - start));
+	}
+	for (i = 0; i < n; i++)
+		close(fds[i].fd);
+	free(fds);
+	kill(pid, SIGQUIT);
+	waitpid(pid, &status, 0);
+	unlink(addr.sun_path);
+	rmdir(path);
+	close(null);
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Measures how long the shell takes from receiving a command line to
+ *   the command running, with and without the helper pool.
+ */
+static void
+bench_spawn(long n)
+{
+	char *plainargv[] = { (char *)shell, "-p", NULL };
+	char *poolargv[] = { (char *)shell, "-p", "-o", "pool", NULL };
+	double secs;
+
+	secs = interact(plainargv, n);
+	printf("spawn: fork: %ld commands, %.1f us/command\n", n,
+	    secs / n * 1e6);
+	secs = interact(poolargv, n);
+	printf("spawn: pool: %ld commands, %.1f us/command\n", n,
+	    secs / n * 1e6);
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Starts the shell "n" times, one at a time, on a pair of pipes, and
+ *   times each one from just before fork() until its prompt can be read.
+ *   Then closes its stdin, so that it exits, and waits for it.  This is
+ *   the latency a caller that starts many short-lived shells pays before
+ *   the first command can run.
+ */
+static void
+bench_startup(long n)
+{
+	char *argv[] = { (char *)shell, NULL };
+	char reply[16];
+	double *secs, start, total = 0;
+	int in[2], out[2], status;
+	pid_t pid;
+	long i;
+
+	if ((secs = malloc(n * sizeof(double))) == NULL)
+		unix_error("malloc error");
+	for (i = 0; i < n; i++) {
+		if (pipe(in) < 0 || pipe(out) < 0)
+			unix_error("pipe error");
+		start = now();
+		if ((pid = fork()) < 0)
+			unix_error("fork error");
+		if (pid == 0) {
+			if (dup2(in[0], STDIN_FILENO) < 0 ||
+			    dup2(out[1], STDOUT_FILENO) < 0)
+				unix_error("dup2 error");
+			close(in[0]);
+			close(in[1]);
+			close(out[0]);
+			close(out[1]);
+			execv(argv[0], argv);
+			unix_error(argv[0]);
+		}
+		close(in[0]);
+		close(out[1]);
+		if (read(out[0], reply, sizeof(reply)) <= 0)
+			unix_error("read error");
+		secs[i] = now() - start;
+		total += secs[i];
+		close(in[1]);
+		close(out[0]);
+		if (waitpid(pid, &status, 0) < 0)
+			unix_error("waitpid error");
+	}
+	qsort(secs, n, sizeof(double), cmpdouble);
+	printf("startup: %ld shells, first prompt after %.1f us mean, %.1f us "
+	    "median, %.1f us p99\n", n, total / n * 1e6, secs[n / 2] * 1e6,
+	    secs[n * 99 / 100] * 1e6);
+	free(secs);
+}
+
+/*
+ * Requires:
+ *   "argv" is a NULL-terminated argument list naming the shell and "n" is
+ *   positive.
+ *
+ * Effects:
+ *   Runs the shell on a pair of pipes and sends it "/bin/echo" commands
+ *   one at a time, reading each command's output before sending the next,
+ *   as a person at a prompt would, pausing 2 ms between commands.  Returns
+ *   the total time in seconds spent waiting for the commands.
+ */
+static double
+interact(char **argv, long n)
+{
+	struct timespec think = { .tv_sec = 0, .tv_nsec = 2000000 };
+	char line[] = "/bin/echo x\n", reply[16];
+	int in[2], out[2], status;
+	double start, total = 0;
+	pid_t pid;
+	long i;
+
+	if (pipe(in) < 0 || pipe(out) < 0)
+		unix_error("pipe error");
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid == 0) {
+		if (dup2(in[0], STDIN_FILENO) < 0 ||
+		    dup2(out[1], STDOUT_FILENO) < 0)
+			unix_error("dup2 error");
+		close(in[1]);
+		close(out[0]);
+		execv(argv[0], argv);
+		unix_error(argv[0]);
+	}
+	close(in[0]);
+	close(out[1]);
+	for (i = 0; i < n; i++) {
+		start = now();
+		if (write(in[1], line, sizeof(line) - 1) < 0)
+			unix_error("write error");
+		if (read(out[0], reply, sizeof(reply)) <= 0)
+			unix_error("read error");
+		total += now() - start;
+		// Leaves the shell idle between commands, as a person would.
+		nanosleep(&think, NULL);
+	}
+	close(in[1]);
+	close(out[0]);
+	if (waitpid(pid, &status, 0) < 0)
+		unix_error("waitpid error");
+	return (total);
+}
+
+/*
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Runs the shell with -v, so that it reports every job it starts, stops,
+ *   and reaps, and feeds it n background jobs, a mix of /bin/true and
+ *   5-20 ms myload runs, keeping STRESSJOBS alive at once.  Meanwhile it
+ *   sends INT to some jobs, TSTP to others (and CONT once they are seen to
+ *   stop), and INT, TSTP, and CONT to the shell itself.  At the end it asks
+ *   for the job list, which must be empty, and checks that every job was
+ *   reported started once and reaped once.  A job that was never reaped and
+ *   is a zombie is a lost SIGCHLD.  Exits with status 1 if a check fails.
+ *   Children are told apart by pid, so "n" must stay well below the
+ *   system's pid_max.
+ */
+static void
+bench_stress(long n)
+{
+	static const int shellsigs[] = { SIGINT, SIGTSTP, SIGCONT };
+	size_t size = 4;
+	struct Child *children, *c;
+	char buf[65536], line[256], cmd[64], path[64], stat[256];
+	int in[2], out[2], jid, status;
+	long launched = 0, reaped = 0, stops = 0, kills = 0, lost = 0;
+	long twice = 0, unknown = 0, leftover = 0, full = 0;
+	size_t len = 0, i;
+	double start, secs;
+	bool closed = false, done = false;
+	pid_t pid, shellpid;
+	ssize_t r;
+	FILE *fp;
+
+	while (size < 4 * (size_t)n)
+		size *= 2;
+	if ((children = calloc(size, sizeof(*children))) == NULL)
+		unix_error("calloc error");
+	if (pipe(in) < 0 || pipe(out) < 0)
+		unix_error("pipe error");
+	if ((shellpid = fork()) < 0)
+		unix_error("fork error");
+	if (shellpid == 0) {
+		if (dup2(in[0], STDIN_FILENO) < 0 ||
+		    dup2(out[1], STDOUT_FILENO) < 0)
+			unix_error("dup2 error");
+		close(in[1]);
+		close(out[0]);
+		execl(shell, shell, "-p", "-v", (char *)NULL);
+		unix_error(shell);
+	}
+	close(in[0]);
+	close(out[1]);
+	signal(SIGPIPE, SIG_IGN);
+	srandom(1);
+
+	start = now();
+	while (!done) {
+		// Starts jobs while the shell has room for them.
+		if (!closed && launched - reaped < STRESSJOBS &&
+		    launched < n) {
+			if (launched % 4 == 0)
+				snprintf(cmd, sizeof(cmd),
+				    "./myload -d %ld &\n", 5 + random() % 16);
+			else
+				snprintf(cmd, sizeof(cmd), "/bin/true &\n");
+			if (write(in[1], cmd, strlen(cmd)) < 0)
+				unix_error("write error");
+			launched++;
+		}
+		if (!closed && launched == n && launched - reaped <= 0) {
+			// Everything has been reaped: checks the job list.
+			snprintf(cmd, sizeof(cmd), "jobs\n");
+			if (write(in[1], cmd, strlen(cmd)) < 0)
+				unix_error("write error");
+			close(in[1]);
+			closed = true;
+		}
+
+		// Signals the shell now and then.
+		if (random() % 64 == 0)
+			kill(shellpid, shellsigs[random() % 3]);
+
+		struct pollfd pfd = { .fd = out[0], .events = POLLIN };
+		if (poll(&pfd, 1, launched - reaped < STRESSJOBS &&
+		    launched < n ? 0 : 10) < 0 && errno != EINTR)
+			unix_error("poll error");
+		if (pfd.revents == 0)
+			continue;
+		if ((r = read(out[0], &buf[len], sizeof(buf) - len)) <= 0) {
+			done = true;
+			continue;
+		}
+		len += r;
+
+		// Handles each complete line of the shell's output.
+		char *p = buf, *nl;
+		while ((nl = memchr(p, '\n', &buf[len] - p)) != NULL) {
+			snprintf(line, sizeof(line), "%.*s", (int)(nl - p), p);
+			p = nl + 1;
+			if (sscanf(line, "[%d] (%d)", &jid, &pid) == 2) {
+				c = child(children, size, pid);
+				if (c->launched++ == 0 && c->reaped == 0 &&
+				    random() % 8 == 0) {
+					// Stops or kills some of the jobs.
+					if (random() % 2 == 0) {
+						kill(pid, SIGTSTP);
+						stops++;
+					} else {
+						kill(pid, SIGINT);
+						kills++;
+					}
+				}
+			} else if (sscanf(line, "Job [%d] (%d)", &jid,
+			    &pid) == 2) {
+				c = child(children, size, pid);
+				if (strstr(line, "stopped") != NULL) {
+					// Continues stopped jobs right away.
+					kill(pid, SIGCONT);
+					continue;
+				}
+				if (c->reaped++ > 0)
+					twice++;
+				else
+					reaped++;
+			} else if (strstr(line, "Running") != NULL ||
+			    strstr(line, "Stopped") != NULL) {
+				printf("stress: left in the job table: %s\n",
+				    line);
+				leftover++;
+			} else if (strstr(line, "too many jobs") != NULL) {
+				full++;
+			}
+		}
+		len = &buf[len] - p;
+		memmove(buf, p, len);
+
+		// Catches a shell that has missed a reap.
+		if (!closed && launched == n && now() - start > 60) {
+			printf("stress: gave up waiting for %ld reaps\n",
+			    launched - reaped);
+			close(in[1]);
+			closed = true;
+		}
+	}
+	secs = now() - start;
+	close(out[0]);
+
+	// Accounts for every child.
+	for (i = 0; i < size; i++) {
+		c = &children[i];
+		if (c->pid == 0)
+			continue;
+		if (c->launched == 0 && c->reaped > 0)
+			unknown++;
+		if (c->reaped > 0)
+			continue;
+		// A child that was never reaped is lost if it is a zombie.
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int)c->pid);
+		if ((fp = fopen(path, "r")) != NULL) {
+			if (fgets(stat, sizeof(stat), fp) != NULL &&
+			    strstr(stat, ") Z ") != NULL)
+				lost++;
+			fclose(fp);
+		}
+		printf("stress: (%d) was never reaped\n", (int)c->pid);
+	}
+	if (waitpid(shellpid, &status, 0) < 0)
+		unix_error("waitpid error");
+
+	printf("stress: %ld jobs, %ld reaped in %.2f s (%.0f reaps/sec)\n",
+	    launched, reaped, secs, reaped / secs);
+	printf("stress: %ld stopped and continued, %ld interrupted\n",
+	    stops, kills);
+	printf("stress: %ld reaped twice, %ld never reaped (%ld zombies), "
+	    "%ld unknown, %ld left in the table, %ld rejected as too many\n",
+	    twice, launched - reaped, lost, unknown, leftover, full);
+	free(children);
+	if (twice > 0 || reaped != launched || unknown > 0 || leftover > 0 ||
+	    full > 0 || !WIFEXITED(status)) {
+		printf("stress: FAILED\n");
+		exit(1);
+	}
+	printf("stress: ok\n");
+}
+
+/*
+ * Requires:
+ *   "children" is an open-addressed table of "size" entries, a power of
+ *   two, with at least one free entry.
+ *
+ * Effects:
+ *   Returns the entry for "pid", adding it if it is not there yet.
+ */
+static struct Child *
+child(struct Child *children, size_t size, pid_t pid)
+{
+	size_t i;
+
+	for (i = (size_t)pid * 2654435761u & (size - 1);
+	    children[i].pid != 0 && children[i].pid != pid;
+	    i = (i + 1) & (size - 1))
+		;
+	children[i].pid = pid;
+	return (&children[i]);
+}
+
+/*
+ * Requires:
+ *   "a" and "b" point to doubles.
+ *
+ * Effects:
+ *   Compares two doubles for qsort().
+ */
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the current CLOCK_MONOTONIC time in seconds.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Requires:
+ *   "argv" is a NULL-terminated argument list naming a program.
+ *
+ * Effects:
+ *   Runs the program with its stdin on "infd" (unless "infd" is -1) and its
+ *   stdout on /dev/null, waits for it, and returns the elapsed wall time in
+ *   seconds.
+ */
+static double
+run(char **argv, int infd)
+{
+	double start = now();
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		if (null < 0 || dup2(null, STDOUT_FILENO) < 0)
+			unix_error("dup2 error");
+		if (infd >= 0 && dup2(infd, STDIN_FILENO) < 0)
+			unix_error("dup2 error");
+		execv(argv[0], argv);
+		unix_error(argv[0]);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		unix_error("waitpid error");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fprintf(stderr, "%s exited abnormally\n", argv[0]);
+	return (now() - start);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Creates an empty temporary file and returns its malloc()ed name.
+ */
+static char *
+tmpscript(void)
+{
+	char *path = strdup("/tmp/tshbench.XXXXXX");
+	int fd;
+
+	if (path == NULL)
+		unix_error("strdup error");
+	if ((fd = mkstemp(path)) < 0)
+		unix_error("mkstemp error");
+	close(fd);
+	return (path);
+}
+
+/*
+ * Requires:
+ *   "msg" is a properly terminated string.
+ *
+ * Effects:
+ *   Prints a Unix-style error message and terminates the program.
+ */
+static void
+unix_error(const char *msg)
+{
+
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Prints a help message and terminates the program.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: tshbench [-s shell] <benchmark> [n]\n");
+	fprintf(stderr, "   coproc   usec/request, a process each vs. coproc\n");
+	fprintf(stderr, "   script   lines/sec of an n-line builtin script\n");
+	fprintf(stderr, "   spawn    prompt-to-exec latency, fork vs. pool\n");
+	fprintf(stderr, "   parse    tokenizer MB/s per instruction set\n");
+	fprintf(stderr, "   serve    lines/sec of n clients of one server\n");
+	fprintf(stderr, "   startup  time from fork to the first prompt\n");
+	fprintf(stderr, "   stress   reaps/sec under a SIGCHLD storm\n");
+	exit(1);
+}
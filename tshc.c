@@ -0,0 +1,256 @@
+/*
+ * tshc.c - Client for the tiny shell's server mode ("tsh --serve").
+ *
+ * usage: tshc [-p] [-c command] socket
+ *
+ * Connects to the server, hands it this process's stdin, stdout, and
+ * stderr, and then sends it the command lines typed at a "tsh> " prompt,
+ * or the single line given with -c, waiting for each one to finish.  The
+ * server runs the jobs on those descriptors, and sends the shell's own
+ * output, which the client writes to its stdout.  ctrl-c and ctrl-z go to
+ * the line's foreground job.  Exits with the status of the last line.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+#define MAXLINE 1024
+
+static int sock = -1;                   // connection to the server
+
+static int	connect_server(const char *path);
+static void	put(const char *buf, size_t len);
+static int	run(const char *line);
+static void	sigfwd_handler(int signum);
+static void	usage(void);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Runs the client as described on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	static const int stdfds[3] = { STDIN_FILENO, STDOUT_FILENO,
+	    STDERR_FILENO };
+	struct sigaction action;
+	char line[MAXLINE];
+	const char *command = NULL;
+	bool emit_prompt = true;
+	int c, status = 0;
+
+	while ((c = getopt(argc, argv, "hpc:")) != -1) {
+		switch (c) {
+		case 'p':             // Don't print a prompt.
+			emit_prompt = false;
+			break;
+		case 'c':             // Run one command line and exit.
+			command = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 1 != argc)
+		usage();
+
+	sock = connect_server(argv[optind]);
+	if (!srv_send(sock, SRV_HELLO, NULL, 0, stdfds, 3)) {
+		perror("tshc: send");
+		exit(1);
+	}
+	// Forwards ctrl-c and ctrl-z to the foreground job.
+	action.sa_handler = sigfwd_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGINT, &action, NULL) < 0 ||
+	    sigaction(SIGTSTP, &action, NULL) < 0) {
+		perror("tshc: sigaction");
+		exit(1);
+	}
+
+	if (command != NULL)
+		exit(run(command));
+	while (true) {
+		if (emit_prompt) {
+			printf("tsh> ");
+			fflush(stdout);
+		}
+		if (fgets(line, sizeof(line), stdin) == NULL)
+			break;
+		status = run(line);
+	}
+	exit(status);
+}
+
+/*
+ * Requires:
+ *   "path" is a properly terminated string.
+ *
+ * Effects:
+ *   Connects to the server's socket "path", retrying for up to a second
+ *   while a server that was just started creates it, and returns the
+ *   connected socket.  Exits if there is no server.
+ */
+static int
+connect_server(const char *path)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000000 };
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd, tries;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "tshc: %s: socket path too long\n", path);
+		exit(1);
+	}
+	strcpy(addr.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("tshc: socket");
+		exit(1);
+	}
+	for (tries = 0; connect(fd, (struct sockaddr *)&addr,
+	    sizeof(addr)) < 0; tries++) {
+		if ((errno != ENOENT && errno != ECONNREFUSED) ||
+		    tries == 100) {
+			fprintf(stderr, "tshc: %s: %s\n", path,
+			    strerror(errno));
+			exit(1);
+		}
+		nanosleep(&pause, NULL);
+	}
+	return (fd);
+}
+
+/*
+ * Requires:
+ *   "line" is a properly terminated command line.
+ *
+ * Effects:
+ *   Sends "line" to the server and waits until the server is done with it,
+ *   writing the shell's output that comes meanwhile, and answering the
+ *   server's SRV_SYNC once it is written.  Returns the line's exit status.  Exits if the session ends, with
+ *   status 0 after quit and 1 if the server went away.
+ */
+static int
+run(const char *line)
+{
+	static char buf[SRV_MAXFRAME];
+	static size_t len = 0;
+	const char *payload;
+	size_t plen;
+	ssize_t n, size;
+	int fds[3], nfds, type, status;
+
+	if (!srv_send(sock, SRV_CMD, line, strnlen(line, MAXLINE - 2), NULL,
+	    0)) {
+		perror("tshc: send");
+		exit(1);
+	}
+	while (true) {
+		while ((size = srv_frame(buf, len, &type, &payload,
+		    &plen)) == 0) {
+			n = srv_recv(sock, &buf[len], sizeof(buf) - len, fds,
+			    3, &nfds);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				fprintf(stderr, "tshc: server went away\n");
+				exit(1);
+			}
+			len += n;
+		}
+		if (size < 0) {
+			fprintf(stderr, "tshc: bad frame from server\n");
+			exit(1);
+		}
+		if (type == SRV_OUT)
+			put(payload, plen);
+		else if (type == SRV_SYNC && !srv_send(sock, SRV_SYNC, NULL,
+		    0, NULL, 0)) {
+			perror("tshc: send");
+			exit(1);
+		}
+		status = type == SRV_DONE && plen == 1 ?
+		    (unsigned char)payload[0] : -1;
+		// The payload is gone once the frame is consumed.
+		len -= size;
+		memmove(buf, &buf[size], len);
+		if (type == SRV_BYE)
+			exit(0);
+		if (status >= 0)
+			return (status);
+	}
+}
+
+/*
+ * Requires:
+ *   "buf" holds "len" bytes.
+ *
+ * Effects:
+ *   Writes all of "buf" to stdout.  Exits if that fails.
+ */
+static void
+put(const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(STDOUT_FILENO, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("tshc: write");
+			exit(1);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Forwards the signal to the server, which sends it to the foreground job
+ *   of the line being run, if there is one.
+ */
+static void
+sigfwd_handler(int signum)
+{
+	int olderrno = errno;
+	unsigned char sig = signum;
+
+	srv_send(sock, SRV_SIGNAL, &sig, 1, NULL, 0);
+	errno = olderrno;
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Prints a help message and terminates the program.
+ */
+static void
+usage(void)
+{
+
+	fprintf(stderr, "Usage: tshc [-p] [-c command] socket\n");
+	fprintf(stderr, "   -p   do not emit a command prompt\n");
+	fprintf(stderr, "   -c   run the command line and exit\n");
+	exit(1);
+}
@@ -0,0 +1,591 @@
+/*
+ * tshreplay.c - Replays a session recorded with "tsh --record".
+ *
+ * usage: tshreplay [-qv] [-s shell] [-o file] recording
+ *
+ * Runs the shell (./tsh by default) with a new recording, feeding it the
+ * recorded input lines and sending it the recorded INT, TSTP, and QUIT
+ * signals.  Each input is held back until the shell has reached the same
+ * point (the same count of prompts and job starts) as when it was
+ * recorded, and then for the same time after that point as was recorded.
+ * Standard input is closed at the end of the recording.
+ *
+ * The two timelines are then compared, leaving out pids, prompts, and
+ * SIGCHLD, whose count depends on timing: differing events are printed as
+ * "-" (recorded) and "+" (replayed) lines.  Last comes the latency of each
+ * input line, from the line to the next prompt, in both runs: the mean and
+ * 99th percentile, and the lines that took more than twice as long (and at
+ * least a millisecond longer) when replayed.  -q leaves the latencies out,
+ * -v passes the shell's output through, and -o keeps the new recording.
+ * Exits with status 1 if the timelines differ.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXLINE 1024
+#define MAXTEXT (4 * MAXLINE + 64)
+#define LOOKAHEAD 16                    // events searched to resync a diff
+#define STALL 5000000                   // usecs to wait for the shell
+
+struct Event {
+	long long usec;                 // time since the shell started
+	char type;                      // L, C, P, S, or J
+	bool anchor;                    // a prompt or a job start
+	char text[MAXTEXT];             // the rest of the line
+};
+
+struct Timeline {
+	struct Event *events;
+	size_t n, size;
+	char buf[2 * MAXTEXT];          // a partial line
+	size_t len;
+};
+
+static int	cmplong(const void *a, const void *b);
+static size_t	compare(const struct Timeline *rec,
+		    const struct Timeline *rep, bool *same);
+static void	follow(struct Timeline *tl, int fd);
+static void	latency(const struct Timeline *rec,
+		    const struct Timeline *rep);
+static void	lineof(const struct Event *e, char *line);
+static long long now(void);
+static void	normalize(const struct Event *e, char *text);
+static void	parse(struct Timeline *tl, const char *line);
+static void	pause_for(long long usec);
+static bool	reached(const struct Timeline *tl, size_t want,
+		    long long *usec);
+static void	summarize(const char *name, long *lat, size_t n);
+static void	usage(void);
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Replays the recording given on the command line.
+ */
+int
+main(int argc, char **argv)
+{
+	static struct Timeline rec, rep;
+	static char path[] = "/tmp/tshreplay.XXXXXX";
+	const char *shell = "./tsh", *out = NULL;
+	char line[MAXTEXT];
+	struct Event *e;
+	FILE *fp;
+	long long start, at, when;
+	size_t i, n, want;
+	bool quiet = false, verbose = false, same, exited = false;
+	int c, fd, in[2], status, nullfd;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "hqvs:o:")) != -1) {
+		switch (c) {
+		case 'q':             // Leave out the latencies.
+			quiet = true;
+			break;
+		case 'v':             // Pass the shell's output through.
+			verbose = true;
+			break;
+		case 's':             // Replay with another shell.
+			shell = optarg;
+			break;
+		case 'o':             // Keep the new recording.
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind + 1 != argc)
+		usage();
+
+	if ((fp = fopen(argv[optind], "r")) == NULL) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+		parse(&rec, line);
+	fclose(fp);
+	if (rec.n == 0) {
+		fprintf(stderr, "tshreplay: %s: empty recording\n",
+		    argv[optind]);
+		exit(1);
+	}
+
+	if ((fd = out != NULL ? open(out, O_RDONLY | O_CREAT | O_TRUNC,
+	    0666) : mkstemp(path)) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		perror(out != NULL ? out : "mkstemp");
+		exit(1);
+	}
+	if (pipe(in) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	fflush(stdout);
+	start = now();
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		// Keep the shell's signals from reaching tshreplay.
+		setpgid(0, 0);
+		dup2(in[0], STDIN_FILENO);
+		if (!verbose && (nullfd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(nullfd, STDOUT_FILENO);
+			dup2(nullfd, STDERR_FILENO);
+		}
+		close(in[0]);
+		close(in[1]);
+		if (rec.events[0].type == 'C') {
+			lineof(&rec.events[0], line);
+			line[strcspn(line, "\n")] = '\0';
+			execl(shell, shell, "--record", out != NULL ? out :
+			    path, "-c", line, (char *)NULL);
+		} else
+			execl(shell, shell, "-p", "--record", out != NULL ?
+			    out : path, (char *)NULL);
+		perror(shell);
+		_exit(1);
+	}
+	close(in[0]);
+
+	// Feeds each input once the shell has reached its anchor.
+	for (i = 0, want = 0, at = 0; i <= rec.n; i++) {
+		e = i < rec.n ? &rec.events[i] : NULL;
+		if (e != NULL && e->anchor) {
+			want++;
+			at = e->usec;
+			continue;
+		}
+		if (e != NULL && e->type != 'L' && (e->type != 'S' ||
+		    strcmp(e->text, "CHLD") == 0))
+			continue;
+		while (!reached(&rep, want, &when)) {
+			if (waitpid(pid, &status, WNOHANG) == pid) {
+				exited = true;
+				break;
+			}
+			if (now() - start > when + STALL) {
+				fprintf(stderr, "tshreplay: shell stalled "
+				    "before event %zu\n", i + 1);
+				break;
+			}
+			pause_for(1000);
+			follow(&rep, fd);
+		}
+		if (exited)
+			break;
+		// The anchor's replayed time, plus the recorded delay.
+		pause_for(when + ((e != NULL ? e->usec :
+		    rec.events[rec.n - 1].usec) - at) - (now() - start));
+		if (e == NULL)
+			close(in[1]);
+		else if (e->type == 'L') {
+			lineof(e, line);
+			if (write(in[1], line, strlen(line)) < 0)
+				break;
+		} else
+			kill(pid, strcmp(e->text, "INT") == 0 ? SIGINT :
+			    strcmp(e->text, "TSTP") == 0 ? SIGTSTP : SIGQUIT);
+	}
+	close(in[1]);
+	if (!exited)
+		waitpid(pid, &status, 0);
+	follow(&rep, fd);
+	if (out == NULL)
+		unlink(path);
+
+	n = compare(&rec, &rep, &same);
+	printf("%zu events compared, timelines %s\n", n, same ? "match" :
+	    "differ");
+	if (!quiet)
+		latency(&rec, &rep);
+	exit(same ? 0 : 1);
+}
+
+/*
+ * Requires:
+ *   "a" and "b" point to longs.
+ *
+ * Effects:
+ *   Compares two longs for qsort().
+ */
+static int
+cmplong(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Requires:
+ *   "rec" and "rep" are parsed recordings.
+ *
+ * Effects:
+ *   Prints the events in which the two timelines differ, resyncing on the
+ *   nearest match within LOOKAHEAD events, and sets "*same" to whether
+ *   there were none.  Returns the number of recorded events compared.
+ */
+static size_t
+compare(const struct Timeline *rec, const struct Timeline *rep, bool *same)
+{
+	static char a[LOOKAHEAD][MAXTEXT], b[MAXTEXT];
+	size_t i = 0, j = 0, k, l, na, nb, skipa, skipb, n = 0;
+	size_t ia[LOOKAHEAD], jb[LOOKAHEAD];
+	char text[MAXTEXT];
+
+	for (k = 0; k < rec->n; k++) {
+		normalize(&rec->events[k], text);
+		if (text[0] != '\0')
+			n++;
+	}
+
+	*same = true;
+	while (i < rec->n || j < rep->n) {
+		// Collects the next LOOKAHEAD comparable events of each.
+		for (na = 0, k = i; k < rec->n && na < LOOKAHEAD; k++) {
+			normalize(&rec->events[k], a[na]);
+			if (a[na][0] != '\0')
+				ia[na++] = k;
+		}
+		for (nb = 0, k = j; k < rep->n && nb < LOOKAHEAD; k++) {
+			normalize(&rep->events[k], text);
+			if (text[0] != '\0')
+				jb[nb++] = k;
+		}
+		if (na == 0 && nb == 0)
+			break;
+		// Finds the match that skips the fewest events.
+		skipa = na;
+		skipb = nb;
+		for (l = 0; l < nb; l++) {
+			normalize(&rep->events[jb[l]], b);
+			for (k = 0; k < na && k + l < skipa + skipb; k++)
+				if (strcmp(a[k], b) == 0) {
+					skipa = k;
+					skipb = l;
+					break;
+				}
+		}
+		if (skipa + skipb > 0)
+			*same = false;
+		for (k = 0; k < skipa; k++)
+			printf("- %lld %s\n", rec->events[ia[k]].usec, a[k]);
+		for (l = 0; l < skipb; l++) {
+			normalize(&rep->events[jb[l]], b);
+			printf("+ %lld %s\n", rep->events[jb[l]].usec, b);
+		}
+		if (skipa == na || skipb == nb) {
+			i = skipa == na ? (na > 0 ? ia[na - 1] + 1 : rec->n) :
+			    ia[skipa];
+			j = skipb == nb ? (nb > 0 ? jb[nb - 1] + 1 : rep->n) :
+			    jb[skipb];
+			continue;
+		}
+		i = ia[skipa] + 1;
+		j = jb[skipb] + 1;
+	}
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "fd" is open on the shell's new recording.
+ *
+ * Effects:
+ *   Adds the events that the shell has recorded since the last call.
+ */
+static void
+follow(struct Timeline *tl, int fd)
+{
+	ssize_t n;
+	char *nl;
+
+	while ((n = read(fd, &tl->buf[tl->len], sizeof(tl->buf) - 1 -
+	    tl->len)) > 0) {
+		tl->len += n;
+		tl->buf[tl->len] = '\0';
+		while ((nl = strchr(tl->buf, '\n')) != NULL) {
+			*nl = '\0';
+			parse(tl, tl->buf);
+			tl->len -= nl + 1 - tl->buf;
+			memmove(tl->buf, nl + 1, tl->len + 1);
+		}
+		if (tl->len == sizeof(tl->buf) - 1)
+			tl->len = 0;
+	}
+}
+
+/*
+ * Requires:
+ *   "rec" and "rep" are parsed recordings.
+ *
+ * Effects:
+ *   Prints the latency of the input lines in both runs, and the lines
+ *   that slowed down.
+ */
+static void
+latency(const struct Timeline *rec, const struct Timeline *rep)
+{
+	long *reclat, *replat;
+	size_t i, j, k, n = 0, m = 0;
+	char line[MAXTEXT];
+
+	reclat = calloc(rec->n + 1, sizeof(long));
+	replat = calloc(rep->n + 1, sizeof(long));
+	if (reclat == NULL || replat == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0, j = 0; i < rec->n; i++) {
+		if (rec->events[i].type != 'L')
+			continue;
+		// Pairs the line with its replayed copy, if any.
+		while (j < rep->n && (rep->events[j].type != 'L' ||
+		    strcmp(rep->events[j].text, rec->events[i].text) != 0))
+			j++;
+		reclat[n] = -1;
+		for (k = i + 1; k < rec->n; k++)
+			if (rec->events[k].type == 'P') {
+				reclat[n] = rec->events[k].usec -
+				    rec->events[i].usec;
+				break;
+			}
+		if (reclat[n] < 0)
+			continue;
+		replat[n] = -1;
+		for (k = j + 1; k < rep->n; k++)
+			if (rep->events[k].type == 'P') {
+				replat[n] = rep->events[k].usec -
+				    rep->events[j].usec;
+				break;
+			}
+		if (j < rep->n && replat[n] >= 0) {
+			if (replat[n] > 2 * reclat[n] &&
+			    replat[n] - reclat[n] >= 1000) {
+				lineof(&rec->events[i], line);
+				printf("slower: %ld us -> %ld us: %s", reclat[n],
+				    replat[n], line);
+			}
+			m++;
+		}
+		n++;
+		if (j < rep->n)
+			j++;
+	}
+	summarize("recorded", reclat, n);
+	// Leaves out the lines that were never answered.
+	for (i = 0, j = 0; i < n; i++)
+		if (replat[i] >= 0)
+			replat[j++] = replat[i];
+	summarize("replayed", replat, m);
+	free(reclat);
+	free(replat);
+}
+
+/*
+ * Requires:
+ *   "e" is an L or C event, and "line" has room for MAXTEXT characters.
+ *
+ * Effects:
+ *   Undoes the escaping of the recorded input line.
+ */
+static void
+lineof(const struct Event *e, char *line)
+{
+	const char *p;
+	unsigned int c;
+
+	for (p = e->text; *p != '\0'; p++) {
+		if (*p != '\\' || p[1] == '\0')
+			*line++ = *p;
+		else if (*++p == 'n')
+			*line++ = '\n';
+		else if (*p == 'x' && sscanf(p + 1, "%2x", &c) == 1) {
+			*line++ = c;
+			p += 2;
+		} else
+			*line++ = *p;
+	}
+	*line = '\0';
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the current CLOCK_MONOTONIC time in microseconds.
+ */
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+}
+
+/*
+ * Requires:
+ *   "text" has room for MAXTEXT characters.
+ *
+ * Effects:
+ *   Stores the event as compared, "<type> <text>" without a job's pid, or
+ *   the empty string for the prompts and SIGCHLD, which are not compared.
+ */
+static void
+normalize(const struct Event *e, char *text)
+{
+	int jid, skip = 0;
+
+	if (e->type == 'P' || (e->type == 'S' && strcmp(e->text, "CHLD") == 0))
+		text[0] = '\0';
+	else if (e->type == 'J' && sscanf(e->text, "%d %*d %n", &jid,
+	    &skip) == 1 && skip > 0)
+		snprintf(text, MAXTEXT, "J %d %s", jid, &e->text[skip]);
+	else
+		snprintf(text, MAXTEXT, "%c %.*s", e->type, MAXTEXT - 3,
+		    e->text);
+}
+
+/*
+ * Requires:
+ *   "line" is a properly terminated string.
+ *
+ * Effects:
+ *   Adds the recorded event on "line" to the timeline, ignoring lines that
+ *   are not events.
+ */
+static void
+parse(struct Timeline *tl, const char *line)
+{
+	struct Event *e;
+	long long usec;
+	char type;
+	int skip = 0;
+
+	if (sscanf(line, "%lld %c%n", &usec, &type, &skip) != 2)
+		return;
+	if (tl->n == tl->size) {
+		tl->size = tl->size == 0 ? 64 : 2 * tl->size;
+		if ((tl->events = realloc(tl->events, tl->size *
+		    sizeof(struct Event))) == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	e = &tl->events[tl->n++];
+	e->usec = usec;
+	e->type = type;
+	line += skip + (line[skip] == ' ');
+	snprintf(e->text, sizeof(e->text), "%.*s", (int)strcspn(line, "\n"),
+	    line);
+	// Job starts and continues happen in the shell's own order.
+	skip = 0;
+	if (type == 'J')
+		sscanf(e->text, "%*d %*d %n", &skip);
+	e->anchor = type == 'P' || (skip > 0 &&
+	    (strncmp(&e->text[skip], "fg", 2) == 0 ||
+	    strncmp(&e->text[skip], "bg", 2) == 0));
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Sleeps for "usec" microseconds, if positive.
+ */
+static void
+pause_for(long long usec)
+{
+	struct timespec ts;
+
+	if (usec <= 0)
+		return;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = usec % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns whether the timeline has "want" anchors, setting "*usec" to
+ *   the time of the last of them, or of the last event if there are fewer.
+ */
+static bool
+reached(const struct Timeline *tl, size_t want, long long *usec)
+{
+	size_t i;
+
+	*usec = 0;
+	for (i = 0; i < tl->n && want > 0; i++) {
+		*usec = tl->events[i].usec;
+		if (tl->events[i].anchor)
+			want--;
+	}
+	return (want == 0);
+}
+
+/*
+ * Requires:
+ *   "lat" holds "n" latencies in microseconds.
+ *
+ * Effects:
+ *   Prints their mean and 99th percentile.
+ */
+static void
+summarize(const char *name, long *lat, size_t n)
+{
+	long long sum = 0;
+	size_t i;
+
+	if (n == 0) {
+		printf("%s: no input lines\n", name);
+		return;
+	}
+	qsort(lat, n, sizeof(long), cmplong);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	printf("%s: %zu lines, mean %lld us, p99 %ld us\n", name, n,
+	    sum / (long long)n, lat[(n * 99 + 99) / 100 - 1]);
+}
+
+/*
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Prints a help message and terminates the program.
+ */
+static void
+usage(void)
+{
+
+	printf("Usage: tshreplay [-qv] [-s shell] [-o file] recording\n");
+	printf("   -q   leave out the latencies\n");
+	printf("   -v   pass the shell's output through\n");
+	printf("   -s   replay with shell instead of ./tsh\n");
+	printf("   -o   keep the new recording in file\n");
+	exit(1);
+}